@@ -0,0 +1,508 @@
+#include "scene.h"
+#include "obj.h"
+#include "ply.h"
+
+#include <algorithm>
+#include <functional>
+
+/**
+ * Microbenchmarks of the renderer's core kernels. Every benchmark is
+ * calibrated to run for at least minTime per repetition and repeated, the
+ * reported ns/op is the median over the repetitions.
+ */
+
+struct BenchResult {
+    std::string name;
+    long long iterations;
+    std::vector<double> nsPerOp;
+
+    double median() { return this->nsPerOp[this->nsPerOp.size() / 2]; }
+    double mean()
+    {
+        double sum = 0.0;
+        for (double v : this->nsPerOp)
+            sum += v;
+        return sum / this->nsPerOp.size();
+    }
+    double stddev()
+    {
+        double m = this->mean(), sum = 0.0;
+        for (double v : this->nsPerOp)
+            sum += (v - m) * (v - m);
+        return std::sqrt(sum / std::max<size_t>(this->nsPerOp.size() - 1, 1));
+    }
+};
+
+// Results are added here so the compiler cannot drop the benchmarked work
+static volatile float sink;
+
+struct BenchSuite {
+    int repetitions = 10;
+    double minTime = 0.02;
+    std::string filter;
+    std::vector<BenchResult> results;
+
+    // body(n) performs n operations and returns a value depending on all of
+    // them. Calibration starts at firstN operations.
+    void run(std::string name, std::function<float(long long)> body, long long firstN = 16)
+    {
+        if (!this->filter.empty() && name.find(this->filter) == std::string::npos)
+            return;
+
+        auto timeRun = [&](long long n) {
+            auto start = std::chrono::steady_clock::now();
+            sink = sink + body(n);
+            return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        };
+
+        // Grow the iteration count until one run takes minTime
+        long long n = firstN;
+        double seconds = timeRun(n);
+        while (seconds < this->minTime) {
+            n = seconds > 0.0 ? std::max(2 * n, (long long)(n * 1.2 * this->minTime / seconds)) : 2 * n;
+            seconds = timeRun(n);
+        }
+
+        BenchResult result;
+        result.name = name;
+        result.iterations = n;
+        for (int r = 0; r < this->repetitions; r++)
+            result.nsPerOp.push_back(timeRun(n) * 1e9 / n);
+        std::sort(result.nsPerOp.begin(), result.nsPerOp.end());
+
+        printf("%-28s %12.2f ns/op %14.0f ops/s  +- %5.1f%%  (min %.2f, %lld x %d)\n",
+            name.c_str(), result.median(), 1e9 / result.median(), 100.0 * result.stddev() / result.mean(),
+            result.nsPerOp.front(), n, this->repetitions);
+        fflush(stdout);
+        this->results.push_back(result);
+    }
+
+    bool writeJson(std::string path)
+    {
+        nlohmann::json out;
+        out["repetitions"] = this->repetitions;
+        out["minTime"] = this->minTime;
+        for (auto& r : this->results) {
+            out["benchmarks"].push_back({
+                { "name", r.name },
+                { "iterations", r.iterations },
+                { "nsPerOp", r.median() },
+                { "opsPerSec", 1e9 / r.median() },
+                { "minNsPerOp", r.nsPerOp.front() },
+                { "meanNsPerOp", r.mean() },
+                { "stddevNsPerOp", r.stddev() }
+            });
+        }
+
+        std::ofstream file(path.c_str());
+        if (!file) {
+            std::cerr << "Could not write " << path << std::endl;
+            return false;
+        }
+        file << out.dump(2) << std::endl;
+        return true;
+    }
+};
+
+static Vector3f randomPoint(Vector3f lower, Vector3f upper)
+{
+    return Vector3f(
+        lower.x + (upper.x - lower.x) * next_float(),
+        lower.y + (upper.y - lower.y) * next_float(),
+        lower.z + (upper.z - lower.z) * next_float());
+}
+
+// Rays from a box around the origin towards points in [-1, 1]^3
+static std::vector<Ray> randomRays(size_t count)
+{
+    std::vector<Ray> rays;
+    for (size_t i = 0; i < count; i++) {
+        Vector3f o = randomPoint(Vector3f(-4.f), Vector3f(4.f)) + Vector3f(0.f, 0.f, 6.f);
+        Vector3f target = randomPoint(Vector3f(-1.f), Vector3f(1.f));
+        rays.push_back(Ray(o, Normalize(target - o)));
+    }
+    return rays;
+}
+
+// UV sphere with smooth normals, rings * segments * 2 triangles
+static Surface sphereSurface(Vector3f center, float radius, int rings, int segments)
+{
+    Surface surf;
+    surf.isLight = false;
+    surf.shapeIdx = 0;
+
+    auto point = [&](int ring, int segment) {
+        float theta = M_PI * ring / rings, phi = 2.f * M_PI * segment / segments;
+        return Vector3f(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+    };
+
+    for (int r = 0; r < rings; r++) {
+        for (int s = 0; s < segments; s++) {
+            Vector3f n[4] = { point(r, s), point(r + 1, s), point(r + 1, s + 1), point(r, s + 1) };
+            int quads[2][3] = { { 0, 1, 2 }, { 0, 2, 3 } };
+            for (auto& q : quads) {
+                Vector3f vertices[3], normals[3];
+                Vector2f uvs[3];
+                for (int v = 0; v < 3; v++) {
+                    normals[v] = n[q[v]];
+                    vertices[v] = center + radius * n[q[v]];
+                    uvs[v] = Vector2f(0.f, 0.f);
+                }
+                surf.addTriangle(vertices, normals, uvs);
+            }
+        }
+    }
+
+    surf.buildBVH();
+    return surf;
+}
+
+// grid^3 spheres filling [-1, 1]^3
+static void sphereGridScene(Scene& scene, int grid, int rings, int segments)
+{
+    float spacing = 2.f / grid;
+    for (int z = 0; z < grid; z++) {
+        for (int y = 0; y < grid; y++) {
+            for (int x = 0; x < grid; x++) {
+                Vector3f center = Vector3f(-1.f) + spacing * Vector3f(x + 0.5f, y + 0.5f, z + 0.5f);
+                Surface surf = sphereSurface(center, 0.4f * spacing, rings, segments);
+                surf.shapeIdx = uint32_t(scene.surfaces.size());
+                scene.surfaceIdxs.push_back(surf.shapeIdx);
+                scene.surfaces.push_back(std::move(surf));
+            }
+        }
+    }
+    scene.buildBVH();
+}
+
+/**
+ * Writes grid^3 UV spheres as an OBJ with positions, normals and texture
+ * coordinates, one object and material per sphere. Every other sphere uses
+ * relative indices. Returns the number of triangles.
+ */
+static size_t writeSphereGridObj(std::string path, int grid, int rings, int segments)
+{
+    std::ofstream file(path.c_str());
+    file.precision(6);
+    size_t numTriangles = 0;
+    int numVertices = 0;
+    float spacing = 2.f / grid;
+    for (int i = 0; i < grid * grid * grid; i++) {
+        Vector3f center = Vector3f(-1.f) + spacing * Vector3f(i % grid + 0.5f, (i / grid) % grid + 0.5f, i / (grid * grid) + 0.5f);
+        file << "o sphere" << i << "\nusemtl material" << i % 4 << "\n";
+        for (int r = 0; r <= rings; r++) {
+            for (int s = 0; s <= segments; s++) {
+                float theta = M_PI * r / rings, phi = 2.f * M_PI * s / segments;
+                Vector3f n(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+                Vector3f p = center + 0.4f * spacing * n;
+                file << "v " << p.x << " " << p.y << " " << p.z << "\n";
+                file << "vn " << n.x << " " << n.y << " " << n.z << "\n";
+                file << "vt " << float(s) / segments << " " << float(r) / rings << "\n";
+            }
+        }
+        int first = numVertices;
+        numVertices += (rings + 1) * (segments + 1);
+        auto corner = [&](int r, int s) {
+            int index = first + r * (segments + 1) + s;
+            index = i % 2 ? index - numVertices : index + 1;
+            return std::to_string(index) + "/" + std::to_string(index) + "/" + std::to_string(index);
+        };
+        for (int r = 0; r < rings; r++) {
+            for (int s = 0; s < segments; s++) {
+                file << "f " << corner(r, s) << " " << corner(r + 1, s) << " " << corner(r + 1, s + 1) << "\n";
+                file << "f " << corner(r, s) << " " << corner(r + 1, s + 1) << " " << corner(r, s + 1) << "\n";
+                numTriangles += 2;
+            }
+        }
+    }
+    return numTriangles;
+}
+
+static bool sameIndex(const tinyobj::index_t& a, const tinyobj::index_t& b)
+{
+    return a.vertex_index == b.vertex_index && a.normal_index == b.normal_index && a.texcoord_index == b.texcoord_index;
+}
+
+// Compares everything createSurfaces reads
+static bool sameObj(const ObjFile& a, const ObjFile& b)
+{
+    if (a.attrib.vertices != b.attrib.vertices || a.attrib.normals != b.attrib.normals
+        || a.attrib.texcoords != b.attrib.texcoords || a.shapes.size() != b.shapes.size())
+        return false;
+    for (size_t s = 0; s < a.shapes.size(); s++) {
+        const tinyobj::mesh_t& ma = a.shapes[s].mesh;
+        const tinyobj::mesh_t& mb = b.shapes[s].mesh;
+        if (ma.num_face_vertices != mb.num_face_vertices || ma.material_ids != mb.material_ids
+            || !std::equal(ma.indices.begin(), ma.indices.end(), mb.indices.begin(), mb.indices.end(), sameIndex))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * Writes the meshes of an OBJ whose faces use the same index for positions,
+ * normals and texture coordinates as one PLY mesh
+ */
+static void writePly(std::string path, const ObjFile& obj, bool binary)
+{
+    size_t numVertices = obj.attrib.vertices.size() / 3, numFaces = 0;
+    for (auto& shape : obj.shapes)
+        numFaces += shape.mesh.num_face_vertices.size();
+
+    std::ofstream file(path.c_str(), std::ios::binary);
+    file << "ply\nformat " << (binary ? "binary_little_endian" : "ascii") << " 1.0\n"
+         << "element vertex " << numVertices << "\n"
+         << "property float x\nproperty float y\nproperty float z\n"
+         << "property float nx\nproperty float ny\nproperty float nz\n"
+         << "property float u\nproperty float v\n"
+         << "element face " << numFaces << "\n"
+         << "property list uchar uint vertex_indices\nend_header\n";
+    file.precision(9);
+
+    auto writeLittleEndian = [&](uint32_t bits) {
+        char bytes[4] = { char(bits), char(bits >> 8), char(bits >> 16), char(bits >> 24) };
+        file.write(bytes, 4);
+    };
+    auto writeFloat = [&](float value) {
+        uint32_t bits;
+        memcpy(&bits, &value, 4);
+        writeLittleEndian(bits);
+    };
+    for (size_t i = 0; i < numVertices; i++) {
+        float values[8] = {
+            obj.attrib.vertices[3 * i], obj.attrib.vertices[3 * i + 1], obj.attrib.vertices[3 * i + 2],
+            obj.attrib.normals[3 * i], obj.attrib.normals[3 * i + 1], obj.attrib.normals[3 * i + 2],
+            obj.attrib.texcoords[2 * i], obj.attrib.texcoords[2 * i + 1] };
+        for (int k = 0; k < 8; k++) {
+            if (binary)
+                writeFloat(values[k]);
+            else
+                file << values[k] << (k < 7 ? " " : "\n");
+        }
+    }
+    for (auto& shape : obj.shapes) {
+        for (size_t f = 0; f < shape.mesh.num_face_vertices.size(); f++) {
+            if (binary)
+                file.put(3);
+            else
+                file << "3";
+            for (int k = 0; k < 3; k++) {
+                uint32_t index = uint32_t(shape.mesh.indices[3 * f + k].vertex_index);
+                if (binary)
+                    writeLittleEndian(index);
+                else
+                    file << " " << index;
+            }
+            if (!binary)
+                file << "\n";
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    BenchSuite suite;
+    std::string jsonPath;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--json" && i + 1 < argc)
+            jsonPath = argv[++i];
+        else if (arg == "--filter" && i + 1 < argc)
+            suite.filter = argv[++i];
+        else if (arg == "--repetitions" && i + 1 < argc)
+            suite.repetitions = std::max(1, atoi(argv[++i]));
+        else if (arg == "--min-time" && i + 1 < argc)
+            suite.minTime = atof(argv[++i]);
+        else {
+            std::cerr << "Usage: ./bench [--filter <substring>] [--repetitions <n>] [--min-time <seconds>] [--json <file>]" << std::endl;
+            return 1;
+        }
+    }
+
+    // Inputs are generated up front, 4096 of each so they stay in cache
+    const size_t numInputs = 4096, inputMask = numInputs - 1;
+    seed_random(1, 0, 0);
+    std::vector<Ray> rays = randomRays(numInputs);
+
+    AABB box;
+    box.min = Vector3f(-0.5f);
+    box.max = Vector3f(0.5f);
+    suite.run("aabb_intersects", [&](long long n) {
+        int hits = 0;
+        for (long long i = 0; i < n; i++)
+            hits += box.intersects(rays[i & inputMask]);
+        return float(hits);
+    });
+
+    Surface triangleSurface;
+    Vector3f v1(-1.f, -1.f, 0.f), v2(1.f, -1.f, 0.f), v3(0.f, 1.f, 0.f), triNormal(0.f, 0.f, 1.f);
+    suite.run("triangle_intersect", [&](long long n) {
+        float sum = 0.f;
+        for (long long i = 0; i < n; i++) {
+            Interaction si = triangleSurface.rayTriangleIntersect(rays[i & inputMask], v1, v2, v3, triNormal);
+            sum += si.didIntersect ? si.t : 0.f;
+        }
+        return sum;
+    });
+
+    // Shading points on the floor of a box lit from above
+    std::vector<Interaction> shadingPoints(numInputs);
+    for (auto& si : shadingPoints) {
+        si.p = randomPoint(Vector3f(-1.f, 0.f, -1.f), Vector3f(1.f, 0.f, 1.f));
+        si.n = Vector3f(0.f, 1.f, 0.f);
+        si.didIntersect = true;
+    }
+
+    Light pointLight(POINT_LIGHT, { { "location", { 0, 1.9, 0 } }, { "radiance", { 1, 1, 1 } } });
+    suite.run("light_sample_point", [&](long long n) {
+        float sum = 0.f;
+        for (long long i = 0; i < n; i++)
+            sum += pointLight.sample(&shadingPoints[i & inputMask]).second.d;
+        return sum;
+    });
+
+    Light areaLight(AREA_LIGHT, {
+        { "center", { 0, 1.9, 0 } }, { "vx", { 0.25, 0, 0 } }, { "vy", { 0, 0, 0.25 } },
+        { "normal", { 0, -1, 0 } }, { "radiance", { 1, 1, 1 } } });
+    suite.run("light_sample_area", [&](long long n) {
+        float sum = 0.f;
+        for (long long i = 0; i < n; i++)
+            sum += areaLight.sample(&shadingPoints[i & inputMask]).second.d;
+        return sum;
+    });
+
+    std::vector<Ray> lightRays;
+    for (size_t i = 0; i < numInputs; i++)
+        lightRays.push_back(Ray(shadingPoints[i].p, Normalize(randomPoint(Vector3f(-0.5f, 1.9f, -0.5f), Vector3f(0.5f, 1.9f, 0.5f)) - shadingPoints[i].p)));
+    suite.run("light_intersect_area", [&](long long n) {
+        float sum = 0.f;
+        for (long long i = 0; i < n; i++) {
+            Ray ray = lightRays[i & inputMask];
+            sum += areaLight.intersectLight(&ray).t;
+        }
+        return sum;
+    });
+
+    Texture texture;
+    texture.allocate(TextureType::UNSIGNED_INTEGER_ALPHA, Vector2i(1024, 1024));
+    for (int y = 0; y < 1024; y++)
+        for (int x = 0; x < 1024; x++)
+            texture.writePixelColor(Vector3f(x / 1024.f, y / 1024.f, 0.5f), x, y);
+    std::vector<Vector2f> uvs(numInputs);
+    for (auto& uv : uvs)
+        uv = Vector2f(next_float(), next_float());
+    suite.run("texture_fetch", [&](long long n) {
+        float sum = 0.f;
+        for (long long i = 0; i < n; i++)
+            sum += texture.nearestNeighbourFetch(uvs[i & inputMask]).x;
+        return sum;
+    });
+
+    std::vector<float> values(numInputs);
+    for (auto& v : values)
+        v = next_float();
+    suite.run("write_pixel_color", [&](long long n) {
+        for (long long i = 0; i < n; i++) {
+            float v = values[i & inputMask];
+            texture.writePixelColor(Vector3f(v, v, v), int(i & 1023), int((i >> 10) & 1023));
+        }
+        return float(((uint32_t*)texture.data)[0]);
+    });
+    suite.run("gamma_transform", [&](long long n) {
+        float sum = 0.f;
+        for (long long i = 0; i < n; i++)
+            sum += gammaTransform(values[i & inputMask]);
+        return sum;
+    });
+    suite.run("gamma_encode_lut", [&](long long n) {
+        uint32_t sum = 0;
+        for (long long i = 0; i < n; i++)
+            sum += gammaEncode(values[i & inputMask]);
+        return float(sum);
+    });
+    texture.release();
+
+    Camera camera(Vector3f(0.f, 0.f, 4.f), Vector3f(0.f), Vector3f(0.f, 1.f, 0.f), 45.f, Vector2i(1920, 1080));
+    suite.run("camera_generate_ray", [&](long long n) {
+        float sum = 0.f;
+        for (long long i = 0; i < n; i++)
+            sum += camera.generateRay(int(i % 1920), int((i / 1920) % 1080)).d.z;
+        return sum;
+    });
+
+    // Full traversal: 1 sphere of 2k triangles and 4^3 spheres of 2k triangles each
+    int sizes[2] = { 1, 4 };
+    for (int grid : sizes) {
+        Scene scene;
+        sphereGridScene(scene, grid, 32, 32);
+        std::string name = "scene_intersect_" + std::to_string(grid * grid * grid * 2 * 32 * 32) + "_tris";
+        suite.run(name, [&](long long n) {
+            float sum = 0.f;
+            for (long long i = 0; i < n; i++) {
+                Ray ray = rays[i & inputMask];
+                Interaction si = scene.rayIntersect(ray);
+                sum += si.didIntersect ? si.t : 0.f;
+            }
+            return sum;
+        });
+        scene.release();
+    }
+
+    // OBJ parsing, one operation parses the whole file
+    std::string objPath = "bench_spheres.obj";
+    size_t objTriangles = writeSphereGridObj(objPath, 4, 48, 48);
+    ObjFile tinyobjFile, fastFile;
+    loadObjTinyobj(objPath, tinyobjFile);
+    if (!loadObjFast(objPath, fastFile) || !sameObj(tinyobjFile, fastFile)) {
+        std::cerr << "The fast OBJ parser does not match tinyobjloader on " << objPath << std::endl;
+        std::remove(objPath.c_str());
+        return 1;
+    }
+    std::string objSuffix = "_" + std::to_string(objTriangles) + "_tris";
+    suite.run("obj_parse_tinyobj" + objSuffix, [&](long long n) {
+        size_t shapes = 0;
+        for (long long i = 0; i < n; i++) {
+            ObjFile obj;
+            loadObjTinyobj(objPath, obj);
+            shapes += obj.shapes.size();
+        }
+        return float(shapes);
+    }, 1);
+    suite.run("obj_parse_fast" + objSuffix, [&](long long n) {
+        size_t shapes = 0;
+        for (long long i = 0; i < n; i++) {
+            ObjFile obj;
+            loadObjFast(objPath, obj);
+            shapes += obj.shapes.size();
+        }
+        return float(shapes);
+    }, 1);
+
+    // PLY loading into a surface, the same mesh as above
+    std::string plyPaths[2] = { "bench_spheres_binary.ply", "bench_spheres_ascii.ply" };
+    for (int binary = 1; binary >= 0; binary--) {
+        std::string plyPath = plyPaths[1 - binary];
+        writePly(plyPath, tinyobjFile, binary);
+        Surface plySurface;
+        if (!loadPly(plyPath, plySurface) || plySurface.numTriangles() != objTriangles) {
+            std::cerr << "Could not load " << plyPath << std::endl;
+            return 1;
+        }
+        std::string name = std::string(binary ? "ply_load_binary" : "ply_load_ascii") + objSuffix;
+        suite.run(name, [&](long long n) {
+            size_t tris = 0;
+            for (long long i = 0; i < n; i++) {
+                Surface surf;
+                loadPly(plyPath, surf);
+                tris += surf.numTriangles();
+            }
+            return float(tris);
+        }, 1);
+        std::remove(plyPath.c_str());
+    }
+    std::remove(objPath.c_str());
+
+    if (!jsonPath.empty() && !suite.writeJson(jsonPath))
+        return 1;
+    return 0;
+}
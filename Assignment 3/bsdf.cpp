@@ -19,6 +19,15 @@ Vector3f BSDF::eval(Interaction *si, Vector3f wo) {
     return diffuseColor / M_PI;
 }
 
+size_t BSDF::memoryUsage() {
+    return this->diffuseTexture.memoryUsage() + this->alphaTexture.memoryUsage();
+}
+
+void BSDF::release() {
+    this->diffuseTexture.release();
+    this->alphaTexture.release();
+}
+
 bool BSDF::hasDiffuseTexture() {
     return diffuseTexture.data != 0;
 }
@@ -41,4 +41,42 @@ Ray Camera::generateRay(int x, int y) {
     Vector3f direction = Normalize(pixelCenter - this->from);
 
     return Ray(this->from, direction);
-}
\ No newline at end of file
+}
+
+Ray Camera::centerRay(int x, int y)
+{
+    Vector3f pixelCenter = this->upperLeft + (x + 0.5f) * this->pixelDeltaU + (y + 0.5f) * this->pixelDeltaV;
+    return Ray(this->from, Normalize(pixelCenter - this->from));
+}
+
+bool Camera::project(Vector3f p, Vector2f& pixel)
+{
+    Vector3f d = p - this->from;
+    float depth = -Dot(d, this->w);
+    if (depth <= 0.f)
+        return false;
+
+    // Intersect the viewport plane and express the point in pixel deltas
+    Vector3f onPlane = this->from + d * (this->focusDistance / depth) - this->upperLeft;
+    pixel.x = Dot(onPlane, this->pixelDeltaU) / Dot(this->pixelDeltaU, this->pixelDeltaU);
+    pixel.y = Dot(onPlane, this->pixelDeltaV) / Dot(this->pixelDeltaV, this->pixelDeltaV);
+    return true;
+}
+
+static Vector3f jsonVector(nlohmann::json value, Vector3f fallback)
+{
+    if (!value.is_array() || value.size() != 3)
+        return fallback;
+    return Vector3f(value[0], value[1], value[2]);
+}
+
+Camera Camera::modified(nlohmann::json changes, Vector2i imageResolution)
+{
+    return Camera(
+        jsonVector(changes.value("from", nlohmann::json()), this->from),
+        jsonVector(changes.value("to", nlohmann::json()), this->to),
+        jsonVector(changes.value("up", nlohmann::json()), this->up),
+        changes.value("fieldOfView", this->fieldOfView),
+        imageResolution
+    );
+}
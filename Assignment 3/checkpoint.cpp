@@ -0,0 +1,194 @@
+#include "checkpoint.h"
+#include "trace.h"
+
+#include <cstring>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char checkpointMagic[8] = { 'R', 'N', 'D', 'R', 'C', 'K', 'P', 'T' };
+static const uint32_t checkpointVersion = 4;
+
+static size_t stateSize(const CheckpointHeader& header)
+{
+    size_t numPixels = size_t(header.width) * header.height;
+    return numPixels * (3 * sizeof(float) + sizeof(uint32_t) + sizeof(uint8_t))
+        + (header.hasMoments ? numPixels * sizeof(float) : 0)
+        + (header.costMetric != 0 ? numPixels * sizeof(float) : 0);
+}
+
+static bool sameSettings(const CheckpointHeader& a, const CheckpointHeader& b)
+{
+    return a.width == b.width && a.height == b.height && a.variant == b.variant
+        && a.spp == b.spp && a.seed == b.seed && a.sceneHash == b.sceneHash && a.firstSample == b.firstSample && a.adaptive == b.adaptive
+        && a.threshold == b.threshold && a.minSpp == b.minSpp && a.hasMoments == b.hasMoments
+        && a.costMetric == b.costMetric;
+}
+
+Checkpoint::~Checkpoint()
+{
+    this->close();
+}
+
+bool Checkpoint::create(std::string path, CheckpointHeader settings)
+{
+#ifdef _WIN32
+    std::cerr << "Checkpoints are not supported on this platform." << std::endl;
+    return false;
+#else
+    this->path = path;
+    this->slotSize = stateSize(settings);
+    this->mappingSize = sizeof(CheckpointHeader) + 2 * this->slotSize;
+
+    // An existing checkpoint of the same render (e.g. the one being resumed
+    // from) stays valid until the first save has replaced it.
+    int fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || ftruncate(fd, this->mappingSize) != 0) {
+        std::cerr << "Could not create checkpoint file " << path << std::endl;
+        if (fd >= 0) ::close(fd);
+        return false;
+    }
+
+    void* mapping = mmap(nullptr, this->mappingSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        std::cerr << "Could not map checkpoint file " << path << std::endl;
+        return false;
+    }
+    this->mapping = (unsigned char*)mapping;
+
+    CheckpointHeader* header = (CheckpointHeader*)this->mapping;
+    bool reuse = size_t(st.st_size) == this->mappingSize
+        && std::memcmp(header->magic, checkpointMagic, sizeof(checkpointMagic)) == 0
+        && header->version == checkpointVersion && sameSettings(*header, settings);
+
+    if (!reuse) {
+        *header = settings;
+        std::memcpy(header->magic, checkpointMagic, sizeof(checkpointMagic));
+        header->version = checkpointVersion;
+        header->activeSlot = -1;
+        header->pass[0] = header->pass[1] = 0;
+        msync(this->mapping, sizeof(CheckpointHeader), MS_SYNC);
+    }
+
+    return true;
+#endif
+}
+
+void Checkpoint::save(Framebuffer& fb, std::vector<uint8_t>& active, long long pass)
+{
+    TRACE_SCOPE("Save checkpoint", this->path);
+#ifndef _WIN32
+    if (this->mapping == nullptr) return;
+
+    CheckpointHeader* header = (CheckpointHeader*)this->mapping;
+    int slot = header->activeSlot == 0 ? 1 : 0;
+    unsigned char* dst = this->mapping + sizeof(CheckpointHeader) + slot * this->slotSize;
+    unsigned char* start = dst;
+
+    std::memcpy(dst, fb.color.data(), fb.color.size() * sizeof(float));
+    dst += fb.color.size() * sizeof(float);
+    std::memcpy(dst, fb.sampleCount.data(), fb.sampleCount.size() * sizeof(uint32_t));
+    dst += fb.sampleCount.size() * sizeof(uint32_t);
+    if (header->hasMoments) {
+        std::memcpy(dst, fb.lumSumSq.data(), fb.lumSumSq.size() * sizeof(float));
+        dst += fb.lumSumSq.size() * sizeof(float);
+    }
+    if (header->costMetric != 0) {
+        std::memcpy(dst, fb.cost.data(), fb.cost.size() * sizeof(float));
+        dst += fb.cost.size() * sizeof(float);
+    }
+    std::memcpy(dst, active.data(), active.size());
+
+    // msync needs a page aligned address
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    size_t offset = (start - this->mapping) / pageSize * pageSize;
+    msync(this->mapping + offset, (start - this->mapping) + this->slotSize - offset, MS_SYNC);
+
+    header->pass[slot] = pass;
+    header->activeSlot = slot;
+    msync(this->mapping, sizeof(CheckpointHeader), MS_SYNC);
+#endif
+}
+
+void Checkpoint::close()
+{
+#ifndef _WIN32
+    if (this->mapping != nullptr)
+        munmap(this->mapping, this->mappingSize);
+#endif
+    this->mapping = nullptr;
+}
+
+long long Checkpoint::load(std::string path, CheckpointHeader settings, Framebuffer& fb, std::vector<uint8_t>& active)
+{
+#ifdef _WIN32
+    std::cerr << "Checkpoints are not supported on this platform." << std::endl;
+    return -1;
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(CheckpointHeader)) {
+        std::cerr << "Could not open checkpoint " << path << std::endl;
+        if (fd >= 0) ::close(fd);
+        return -1;
+    }
+
+    void* mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        std::cerr << "Could not map checkpoint " << path << std::endl;
+        return -1;
+    }
+
+    const CheckpointHeader* header = (const CheckpointHeader*)mapping;
+    size_t slotSize = stateSize(*header);
+    long long pass = -1;
+
+    if (std::memcmp(header->magic, checkpointMagic, sizeof(checkpointMagic)) != 0
+        || header->version != checkpointVersion
+        || size_t(st.st_size) < sizeof(CheckpointHeader) + 2 * slotSize) {
+        std::cerr << "Not a valid checkpoint: " << path << std::endl;
+    }
+    else if (!sameSettings(*header, settings)) {
+        std::cerr << "Checkpoint " << path << " was written with different render settings or for a different scene." << std::endl;
+    }
+    else if (header->activeSlot != 0 && header->activeSlot != 1) {
+        std::cerr << "Checkpoint " << path << " holds no completed state." << std::endl;
+    }
+    else {
+        const unsigned char* src = (const unsigned char*)mapping + sizeof(CheckpointHeader) + header->activeSlot * slotSize;
+
+        fb.allocate(Vector2i(header->width, header->height));
+        if (header->hasMoments)
+            fb.trackMoments();
+        if (header->costMetric != 0)
+            fb.trackCost();
+        active.resize(fb.sampleCount.size());
+
+        std::memcpy(fb.color.data(), src, fb.color.size() * sizeof(float));
+        src += fb.color.size() * sizeof(float);
+        std::memcpy(fb.sampleCount.data(), src, fb.sampleCount.size() * sizeof(uint32_t));
+        src += fb.sampleCount.size() * sizeof(uint32_t);
+        if (header->hasMoments) {
+            std::memcpy(fb.lumSumSq.data(), src, fb.lumSumSq.size() * sizeof(float));
+            src += fb.lumSumSq.size() * sizeof(float);
+        }
+        if (header->costMetric != 0) {
+            std::memcpy(fb.cost.data(), src, fb.cost.size() * sizeof(float));
+            src += fb.cost.size() * sizeof(float);
+        }
+        std::memcpy(active.data(), src, active.size());
+
+        pass = header->pass[header->activeSlot];
+    }
+
+    munmap(mapping, st.st_size);
+    return pass;
+#endif
+}
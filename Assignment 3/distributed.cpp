@@ -0,0 +1,385 @@
+#include "distributed.h"
+#include "net.h"
+#include "parallel.h"
+
+#include <deque>
+
+#ifndef _WIN32
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+long long Coordinator::render(std::string pathToJson)
+{
+    std::cerr << "Distributed rendering is not supported on this platform." << std::endl;
+    return -1;
+}
+
+int runWorker(std::string address)
+{
+    std::cerr << "Distributed rendering is not supported on this platform." << std::endl;
+    return 1;
+}
+
+#else
+
+struct WorkerConnection {
+    int fd;
+    bool ready = false;
+    // Tile currently leased to this worker, -1 if idle
+    int lease = -1;
+    // Set once the lease timed out and was handed to another worker
+    bool expired = false;
+    std::chrono::steady_clock::time_point deadline;
+    int tilesRendered = 0;
+};
+
+static std::vector<pid_t> spawnLocalWorkers(std::string executable, std::string address, int count, int threads)
+{
+    std::vector<pid_t> pids;
+    std::string threadArg = std::to_string(threads);
+
+    for (int i = 0; i < count; i++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            execl(executable.c_str(), executable.c_str(), "--worker", address.c_str(),
+                "--threads", threadArg.c_str(), (char*)nullptr);
+            std::cerr << "Could not start worker " << executable << std::endl;
+            _exit(1);
+        }
+        if (pid > 0)
+            pids.push_back(pid);
+    }
+    return pids;
+}
+
+long long Coordinator::render(std::string pathToJson)
+{
+    // Load the scene description only, geometry is loaded by the workers
+    std::string sceneDirectory;
+    const size_t last_slash_idx = pathToJson.rfind('/');
+    if (std::string::npos != last_slash_idx) {
+        sceneDirectory = pathToJson.substr(0, last_slash_idx);
+    }
+
+    std::ifstream sceneStream(pathToJson.c_str());
+    std::string sceneText((std::istreambuf_iterator<char>(sceneStream)), std::istreambuf_iterator<char>());
+    Vector2i resolution;
+    try {
+        auto res = nlohmann::json::parse(sceneText)["output"]["resolution"];
+        resolution = Vector2i(res[0], res[1]);
+    }
+    catch (nlohmann::json::exception e) {
+        std::cerr << "Could not read output resolution from " << pathToJson << std::endl;
+        return -1;
+    }
+
+    nlohmann::json job;
+    job["sceneDirectory"] = sceneDirectory;
+    job["scene"] = sceneText;
+    job["spp"] = this->spp;
+    job["variant"] = variant;
+    job["seed"] = this->seed;
+    job["vertexEncoding"] = int(vertexEncoding);
+    std::string jobText = job.dump();
+
+    this->framebuffer.allocate(resolution);
+
+    std::vector<TileLease> tiles;
+    for (int y = 0; y < resolution.y; y += this->tileSize) {
+        for (int x = 0; x < resolution.x; x += this->tileSize) {
+            TileLease tile;
+            tile.id = int32_t(tiles.size());
+            tile.x0 = x;
+            tile.y0 = y;
+            tile.x1 = std::min(x + this->tileSize, resolution.x);
+            tile.y1 = std::min(y + this->tileSize, resolution.y);
+            tiles.push_back(tile);
+        }
+    }
+
+    int listenFd = listenSocket(this->address, /*loopbackOnly=*/false);
+    if (listenFd < 0)
+        return -1;
+    std::cout << "Coordinator listening on " << this->address << ", " << tiles.size() << " tiles" << std::endl;
+
+    auto startTime = std::chrono::steady_clock::now();
+
+    std::vector<pid_t> children;
+    if (this->spawnWorkers > 0) {
+        int threads = this->workerThreads > 0 ? this->workerThreads : std::max(1, getNumThreads() / this->spawnWorkers);
+        children = spawnLocalWorkers(this->executable, this->address, this->spawnWorkers, threads);
+    }
+
+    std::deque<int> pending;
+    for (auto& tile : tiles)
+        pending.push_back(tile.id);
+    std::vector<uint8_t> done(tiles.size(), 0);
+    size_t numDone = 0;
+    int reissued = 0, maxWorkers = 0;
+    std::vector<int> tilesPerWorker;
+
+    std::vector<WorkerConnection> workers;
+    std::vector<char> payload;
+
+    auto dropWorker = [&](size_t w) {
+        WorkerConnection& worker = workers[w];
+        if (worker.lease >= 0 && !done[worker.lease] && !worker.expired) {
+            pending.push_front(worker.lease);
+            reissued++;
+        }
+        tilesPerWorker.push_back(worker.tilesRendered);
+        closeSocket(worker.fd);
+        workers.erase(workers.begin() + w);
+    };
+
+    bool failed = false;
+    while (numDone < tiles.size() && !failed) {
+        std::vector<pollfd> fds(1 + workers.size());
+        fds[0].fd = listenFd;
+        fds[0].events = POLLIN;
+        for (size_t w = 0; w < workers.size(); w++) {
+            fds[w + 1].fd = workers[w].fd;
+            fds[w + 1].events = POLLIN;
+        }
+        poll(fds.data(), fds.size(), 500);
+
+        // Messages from workers; iterate backwards so drops keep indices valid
+        for (size_t w = workers.size(); w-- > 0;) {
+            if (!(fds[w + 1].revents & (POLLIN | POLLHUP | POLLERR)))
+                continue;
+
+            uint32_t type;
+            if (!recvMessage(workers[w].fd, type, payload)) {
+                std::cerr << "Lost a worker" << std::endl;
+                dropWorker(w);
+                continue;
+            }
+
+            WorkerConnection& worker = workers[w];
+            if (type == MSG_READY) {
+                worker.ready = true;
+            }
+            else if (type == MSG_RESULT && payload.size() >= sizeof(TileLease)) {
+                TileLease echoed;
+                std::memcpy(&echoed, payload.data(), sizeof(echoed));
+                // Only the tile leased to this worker is accepted, with the rectangle it was leased with
+                if (echoed.id != worker.lease) {
+                    std::cerr << "Result for a tile that was not leased to the worker" << std::endl;
+                    dropWorker(w);
+                    continue;
+                }
+                const TileLease& lease = tiles[worker.lease];
+                if (echoed.x0 != lease.x0 || echoed.y0 != lease.y0 || echoed.x1 != lease.x1 || echoed.y1 != lease.y1) {
+                    std::cerr << "Tile result does not match its lease" << std::endl;
+                    dropWorker(w);
+                    continue;
+                }
+                worker.lease = -1;
+                worker.expired = false;
+                if (done[lease.id])
+                    continue;
+
+                Framebuffer tile;
+                tile.allocate(Vector2i(lease.x1 - lease.x0, lease.y1 - lease.y0));
+                size_t colorBytes = tile.color.size() * sizeof(float);
+                size_t countBytes = tile.sampleCount.size() * sizeof(uint32_t);
+                if (payload.size() != sizeof(TileLease) + colorBytes + countBytes) {
+                    std::cerr << "Malformed tile result" << std::endl;
+                    dropWorker(w);
+                    continue;
+                }
+                std::memcpy(tile.color.data(), payload.data() + sizeof(TileLease), colorBytes);
+                std::memcpy(tile.sampleCount.data(), payload.data() + sizeof(TileLease) + colorBytes, countBytes);
+
+                this->framebuffer.addTile(tile, Vector2i(lease.x0, lease.y0));
+                done[lease.id] = 1;
+                numDone++;
+                worker.tilesRendered++;
+            }
+        }
+
+        // New workers get the job description
+        if (fds[0].revents & POLLIN) {
+            int fd = acceptSocket(listenFd);
+            if (fd >= 0) {
+                // A worker that stops mid-message must not stall the coordinator
+                setReceiveTimeout(fd, 30.f);
+                uint32_t type;
+                if (recvMessage(fd, type, payload) && type == MSG_HELLO && sendMessage(fd, MSG_JOB, jobText)) {
+                    WorkerConnection worker;
+                    worker.fd = fd;
+                    workers.push_back(worker);
+                    maxWorkers = std::max(maxWorkers, int(workers.size()));
+                }
+                else {
+                    closeSocket(fd);
+                }
+            }
+        }
+
+        // Leases that ran out are handed to someone else, the late result is ignored
+        auto now = std::chrono::steady_clock::now();
+        for (auto& worker : workers) {
+            if (worker.lease >= 0 && !worker.expired && now > worker.deadline && !done[worker.lease]) {
+                pending.push_front(worker.lease);
+                worker.expired = true;
+                reissued++;
+            }
+        }
+
+        for (size_t w = workers.size(); w-- > 0;) {
+            WorkerConnection& worker = workers[w];
+            while (!pending.empty() && done[pending.front()])
+                pending.pop_front();
+            if (!worker.ready || worker.lease >= 0 || pending.empty())
+                continue;
+
+            int id = pending.front();
+            pending.pop_front();
+            if (!sendMessage(worker.fd, MSG_LEASE, &tiles[id], sizeof(TileLease))) {
+                pending.push_front(id);
+                dropWorker(w);
+                continue;
+            }
+            worker.lease = id;
+            worker.expired = false;
+            worker.deadline = now + std::chrono::milliseconds((long long)(this->leaseTimeout * 1000));
+        }
+
+        // Give up if every local worker has exited and nobody else is connected
+        if (!children.empty() && workers.empty()) {
+            for (size_t c = children.size(); c-- > 0;) {
+                if (waitpid(children[c], nullptr, WNOHANG) == children[c])
+                    children.erase(children.begin() + c);
+            }
+            if (children.empty()) {
+                std::cerr << "All workers exited before the render finished." << std::endl;
+                failed = true;
+            }
+        }
+    }
+
+    for (auto& worker : workers) {
+        sendMessage(worker.fd, MSG_DONE, "");
+        tilesPerWorker.push_back(worker.tilesRendered);
+        closeSocket(worker.fd);
+    }
+    closeSocket(listenFd);
+    if (this->address.compare(0, 5, "unix:") == 0)
+        unlink(this->address.substr(5).c_str());
+    for (pid_t pid : children)
+        waitpid(pid, nullptr, 0);
+    if (failed)
+        return -1;
+
+    auto finishTime = std::chrono::steady_clock::now();
+    long long micros = std::chrono::duration_cast<std::chrono::microseconds>(finishTime - startTime).count();
+
+    std::cout << "Rendered " << tiles.size() << " tiles on " << maxWorkers << " workers, "
+        << reissued << " leases reissued" << std::endl;
+
+    if (!this->reportPath.empty()) {
+        nlohmann::json report;
+        report["workers"] = maxWorkers;
+        report["spawnedWorkers"] = this->spawnWorkers;
+        report["tiles"] = tiles.size();
+        report["tileSize"] = this->tileSize;
+        report["spp"] = this->spp;
+        report["reissuedLeases"] = reissued;
+        report["tilesPerWorker"] = tilesPerWorker;
+        report["renderMs"] = micros / 1000.0;
+
+        std::ofstream out(this->reportPath, std::ios::app);
+        out << report.dump() << std::endl;
+    }
+
+    return micros;
+}
+
+int runWorker(std::string address)
+{
+    // The coordinator may still be starting up
+    int fd = -1;
+    for (int attempt = 0; attempt < 100 && fd < 0; attempt++) {
+        fd = connectSocket(address);
+        if (fd < 0) usleep(100000);
+    }
+    if (fd < 0) {
+        std::cerr << "Could not connect to coordinator at " << address << std::endl;
+        return 1;
+    }
+
+    uint32_t type;
+    std::vector<char> payload;
+    if (!sendMessage(fd, MSG_HELLO, "") || !recvMessage(fd, type, payload) || type != MSG_JOB) {
+        std::cerr << "Coordinator did not send a job" << std::endl;
+        closeSocket(fd);
+        return 1;
+    }
+
+    std::string sceneDirectory, sceneText;
+    long long spp;
+    uint64_t seed;
+    try {
+        auto job = nlohmann::json::parse(std::string(payload.begin(), payload.end()));
+        vertexEncoding = VertexEncoding(job.value("vertexEncoding", int(VERTEX_FLOAT)));
+        sceneDirectory = job.at("sceneDirectory").get<std::string>();
+        sceneText = job.at("scene").get<std::string>();
+        spp = job.at("spp").get<long long>();
+        seed = job.at("seed").get<uint64_t>();
+        variant = job.at("variant").get<int>();
+    }
+    catch (const nlohmann::json::exception& e) {
+        std::cerr << "Malformed job from the coordinator: " << e.what() << std::endl;
+        closeSocket(fd);
+        return 1;
+    }
+
+    Scene scene;
+    try {
+        scene = Scene(sceneDirectory, sceneText);
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        closeSocket(fd);
+        return 1;
+    }
+    Integrator integrator(scene);
+    integrator.spp = spp;
+    integrator.seed = seed;
+
+    if (!sendMessage(fd, MSG_READY, "")) {
+        closeSocket(fd);
+        return 1;
+    }
+
+    while (recvMessage(fd, type, payload) && type == MSG_LEASE && payload.size() == sizeof(TileLease)) {
+        TileLease lease;
+        std::memcpy(&lease, payload.data(), sizeof(lease));
+
+        Framebuffer tile;
+        tile.allocate(Vector2i(lease.x1 - lease.x0, lease.y1 - lease.y0));
+        integrator.renderTile(tile, Vector2i(lease.x0, lease.y0));
+
+        std::vector<char> result(sizeof(TileLease) + tile.color.size() * sizeof(float) + tile.sampleCount.size() * sizeof(uint32_t));
+        char* dst = result.data();
+        std::memcpy(dst, &lease, sizeof(lease));
+        dst += sizeof(lease);
+        std::memcpy(dst, tile.color.data(), tile.color.size() * sizeof(float));
+        dst += tile.color.size() * sizeof(float);
+        std::memcpy(dst, tile.sampleCount.data(), tile.sampleCount.size() * sizeof(uint32_t));
+
+        if (!sendMessage(fd, MSG_RESULT, result.data(), result.size()))
+            break;
+    }
+
+    closeSocket(fd);
+    return 0;
+}
+
+#endif
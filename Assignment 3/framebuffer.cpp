@@ -0,0 +1,380 @@
+#include "framebuffer.h"
+#include "parallel.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "tinyexr/tinyexr.h"
+
+void Framebuffer::allocate(Vector2i resolution)
+{
+    this->resolution = resolution;
+    this->color.assign(3 * size_t(resolution.x) * resolution.y, 0.f);
+    this->sampleCount.assign(size_t(resolution.x) * resolution.y, 0);
+    this->lumSumSq.clear();
+    this->cost.clear();
+}
+
+void Framebuffer::trackMoments()
+{
+    if (!this->hasMoments())
+        this->lumSumSq.assign(this->sampleCount.size(), 0.f);
+}
+
+void Framebuffer::trackCost()
+{
+    if (!this->hasCost())
+        this->cost.assign(this->sampleCount.size(), 0.f);
+}
+
+void Framebuffer::clear()
+{
+    std::fill(this->color.begin(), this->color.end(), 0.f);
+    std::fill(this->sampleCount.begin(), this->sampleCount.end(), 0);
+    std::fill(this->lumSumSq.begin(), this->lumSumSq.end(), 0.f);
+    std::fill(this->cost.begin(), this->cost.end(), 0.f);
+}
+
+void Framebuffer::addTile(Framebuffer& tile, Vector2i origin)
+{
+    for (int y = 0; y < tile.resolution.y; y++) {
+        for (int x = 0; x < tile.resolution.x; x++) {
+            int src = tile.pixelIndex(x, y);
+            int dst = this->pixelIndex(origin.x + x, origin.y + y);
+
+            this->color[3 * dst + 0] += tile.color[3 * src + 0];
+            this->color[3 * dst + 1] += tile.color[3 * src + 1];
+            this->color[3 * dst + 2] += tile.color[3 * src + 2];
+            this->sampleCount[dst] += tile.sampleCount[src];
+            if (this->hasMoments() && tile.hasMoments())
+                this->lumSumSq[dst] += tile.lumSumSq[src];
+            if (this->hasCost() && tile.hasCost())
+                this->cost[dst] += tile.cost[src];
+        }
+    }
+}
+
+Framebuffer Framebuffer::crop(Vector2i origin, Vector2i size)
+{
+    Framebuffer cropped;
+    cropped.allocate(size);
+    if (this->hasMoments())
+        cropped.trackMoments();
+    if (this->hasCost())
+        cropped.trackCost();
+
+    for (int y = 0; y < size.y; y++) {
+        for (int x = 0; x < size.x; x++) {
+            int src = this->pixelIndex(origin.x + x, origin.y + y);
+            int dst = cropped.pixelIndex(x, y);
+
+            cropped.color[3 * dst + 0] = this->color[3 * src + 0];
+            cropped.color[3 * dst + 1] = this->color[3 * src + 1];
+            cropped.color[3 * dst + 2] = this->color[3 * src + 2];
+            cropped.sampleCount[dst] = this->sampleCount[src];
+            if (this->hasMoments())
+                cropped.lumSumSq[dst] = this->lumSumSq[src];
+            if (this->hasCost())
+                cropped.cost[dst] = this->cost[src];
+        }
+    }
+    return cropped;
+}
+
+Vector3f Framebuffer::mean(int p)
+{
+    if (this->sampleCount[p] == 0)
+        return Vector3f(0.f);
+
+    Vector3f sum(this->color[3 * p + 0], this->color[3 * p + 1], this->color[3 * p + 2]);
+    return sum / float(this->sampleCount[p]);
+}
+
+/**
+ * Relative standard error of the luminance mean of pixel p. Needs tracked
+ * moments and at least two samples.
+ */
+float Framebuffer::relativeError(int p)
+{
+    float n = float(this->sampleCount[p]);
+    float mean = luminance(this->mean(p));
+    float variance = std::max(0.f, this->lumSumSq[p] / n - mean * mean) * n / (n - 1);
+    float stdError = std::sqrt(variance / n);
+
+    if (stdError == 0.f)
+        return 0.f;
+    return stdError / std::max(mean, 1e-4f);
+}
+
+float Framebuffer::rmse(Framebuffer& reference)
+{
+    double sum = 0.0;
+    for (size_t p = 0; p < this->sampleCount.size(); p++) {
+        Vector3f d = this->mean(int(p)) - reference.mean(int(p));
+        sum += d.x * d.x + d.y * d.y + d.z * d.z;
+    }
+    return float(std::sqrt(sum / (3.0 * std::max<size_t>(this->sampleCount.size(), 1))));
+}
+
+float Framebuffer::relMse(Framebuffer& reference)
+{
+    double sum = 0.0;
+    for (size_t p = 0; p < this->sampleCount.size(); p++) {
+        Vector3f value = this->mean(int(p)), ref = reference.mean(int(p));
+        for (int c = 0; c < 3; c++) {
+            double d = value[c] - ref[c];
+            sum += d * d / (double(ref[c]) * ref[c] + 0.01);
+        }
+    }
+    return float(sum / (3.0 * std::max<size_t>(this->sampleCount.size(), 1)));
+}
+
+/**
+ * Encodes the pixel means into an 8-bit RGBA texture. Rows are processed in
+ * parallel; each row first resolves its means into a float scanline and then
+ * encodes it through the gamma lookup table, so no std::pow runs per pixel.
+ * The sums and the scanline are interleaved RGB, so both loops walk three
+ * floats per pixel.
+ */
+void Framebuffer::tonemap(Texture& out)
+{
+    TRACE_SCOPE("Tonemap");
+    out.allocate(TextureType::UNSIGNED_INTEGER_ALPHA, this->resolution);
+    uint32_t* dpointer = (uint32_t*)out.data;
+    int width = this->resolution.x;
+
+    parallelFor(0, this->resolution.y, 16, [&](int begin, int end) {
+        std::vector<float> scanline(3 * width);
+        for (int y = begin; y < end; y++) {
+            const float* sums = &this->color[3 * size_t(y) * width];
+            const uint32_t* counts = &this->sampleCount[size_t(y) * width];
+
+            for (int x = 0; x < width; x++) {
+                float inv = counts[x] > 0 ? 1.f / counts[x] : 0.f;
+                scanline[3 * x + 0] = sums[3 * x + 0] * inv;
+                scanline[3 * x + 1] = sums[3 * x + 1] * inv;
+                scanline[3 * x + 2] = sums[3 * x + 2] * inv;
+            }
+
+            uint32_t* line = dpointer + size_t(y) * width;
+            for (int x = 0; x < width; x++) {
+                uint32_t r = gammaEncode(scanline[3 * x + 0]);
+                uint32_t g = gammaEncode(scanline[3 * x + 1]) << 8;
+                uint32_t b = gammaEncode(scanline[3 * x + 2]) << 16;
+                line[x] = r | g | b | (255u << 24);
+            }
+        }
+    });
+}
+
+/**
+ * Writes the linear pixel means into a float RGBA texture.
+ */
+void Framebuffer::resolve(Texture& out)
+{
+    out.allocate(TextureType::FLOAT_ALPHA, this->resolution);
+    float* dpointer = (float*)out.data;
+
+    parallelFor(0, this->resolution.y, 16, [&](int begin, int end) {
+        for (int p = begin * this->resolution.x; p < end * this->resolution.x; p++) {
+            Vector3f m = this->mean(p);
+            dpointer[4 * p + 0] = m.x;
+            dpointer[4 * p + 1] = m.y;
+            dpointer[4 * p + 2] = m.z;
+            dpointer[4 * p + 3] = 1.f;
+        }
+    });
+}
+
+void Framebuffer::save(std::string path)
+{
+    Texture image;
+    size_t pos = path.find(".png");
+
+    if (pos > path.length())
+        this->resolve(image);
+    else
+        this->tonemap(image);
+
+    image.save(path);
+    image.release();
+}
+
+void Framebuffer::saveSampleCounts(std::string path)
+{
+    Texture image;
+    image.allocate(TextureType::FLOAT_ALPHA, this->resolution);
+    for (int y = 0; y < this->resolution.y; y++)
+        for (int x = 0; x < this->resolution.x; x++)
+            image.writePixelColor(Vector3f(float(this->sampleCount[this->pixelIndex(x, y)])), x, y);
+
+    image.saveExr(path);
+    image.release();
+}
+
+// Black, blue, cyan, green, yellow, red, white for t in [0, 1]
+static uint32_t falseColor(float t)
+{
+    static const float stops[7][3] = {
+        { 0, 0, 0 }, { 0, 0, 1 }, { 0, 1, 1 }, { 0, 1, 0 }, { 1, 1, 0 }, { 1, 0, 0 }, { 1, 1, 1 }
+    };
+    t = std::min(std::max(t, 0.f), 1.f) * 6.f;
+    int i = std::min(int(t), 5);
+    float f = t - i;
+
+    uint32_t rgba = 255u << 24;
+    for (int c = 0; c < 3; c++) {
+        float v = stops[i][c] + (stops[i + 1][c] - stops[i][c]) * f;
+        rgba |= uint32_t(v * 255.f + 0.5f) << (8 * c);
+    }
+    return rgba;
+}
+
+void Framebuffer::saveCost(std::string stem)
+{
+    size_t numPixels = this->sampleCount.size();
+    std::vector<float> perSample(numPixels, 0.f);
+    for (size_t p = 0; p < numPixels; p++)
+        perSample[p] = this->sampleCount[p] ? this->cost[p] / this->sampleCount[p] : 0.f;
+
+    Texture values;
+    values.allocate(TextureType::FLOAT_ALPHA, this->resolution);
+    for (int y = 0; y < this->resolution.y; y++)
+        for (int x = 0; x < this->resolution.x; x++)
+            values.writePixelColor(Vector3f(perSample[this->pixelIndex(x, y)]), x, y);
+    values.saveExr(stem + "_cost.exr");
+    values.release();
+
+    // A few extreme pixels should not wash out the rest of the map
+    std::vector<float> sorted = perSample;
+    size_t rank = std::min(numPixels - 1, size_t(0.99 * numPixels));
+    std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+    float scale = sorted[rank] > 0.f ? 1.f / sorted[rank] : 0.f;
+
+    Texture heatmap;
+    heatmap.allocate(TextureType::UNSIGNED_INTEGER_ALPHA, this->resolution);
+    uint32_t* texels = (uint32_t*)heatmap.data;
+    for (size_t p = 0; p < numPixels; p++)
+        texels[p] = falseColor(perSample[p] * scale);
+    heatmap.savePng(stem + "_cost.png");
+    heatmap.release();
+}
+
+// Channels of accumulation EXRs, in the (A)BGR order most viewers expect
+static const char* accumulationChannels[] = { "B", "G", "R", "sampleCount", "sum.B", "sum.G", "sum.R" };
+static const int numAccumulationChannels = 7;
+
+bool Framebuffer::saveAccumulation(std::string path)
+{
+    TRACE_SCOPE("Write accumulation EXR", path);
+    size_t numPixels = this->sampleCount.size();
+    std::vector<std::vector<float>> channels(numAccumulationChannels, std::vector<float>(numPixels));
+
+    for (size_t p = 0; p < numPixels; p++) {
+        Vector3f m = this->mean(int(p));
+        channels[0][p] = m.z;
+        channels[1][p] = m.y;
+        channels[2][p] = m.x;
+        channels[3][p] = float(this->sampleCount[p]);
+        channels[4][p] = this->color[3 * p + 2];
+        channels[5][p] = this->color[3 * p + 1];
+        channels[6][p] = this->color[3 * p + 0];
+    }
+
+    EXRHeader header;
+    InitEXRHeader(&header);
+    EXRImage image;
+    InitEXRImage(&image);
+
+    std::vector<EXRChannelInfo> channelInfos(numAccumulationChannels);
+    std::vector<int> pixelTypes(numAccumulationChannels, TINYEXR_PIXELTYPE_FLOAT);
+    std::vector<unsigned char*> imagePointers(numAccumulationChannels);
+    for (int c = 0; c < numAccumulationChannels; c++) {
+        std::memset(&channelInfos[c], 0, sizeof(EXRChannelInfo));
+        std::strncpy(channelInfos[c].name, accumulationChannels[c], 255);
+        imagePointers[c] = (unsigned char*)channels[c].data();
+    }
+
+    header.compression_type = TINYEXR_COMPRESSIONTYPE_ZIP;
+    header.num_channels = numAccumulationChannels;
+    header.channels = channelInfos.data();
+    header.pixel_types = pixelTypes.data();
+    header.requested_pixel_types = pixelTypes.data();
+
+    image.num_channels = numAccumulationChannels;
+    image.images = imagePointers.data();
+    image.width = this->resolution.x;
+    image.height = this->resolution.y;
+
+    const char* err = nullptr;
+    int ret = SaveEXRImageToFile(&image, &header, path.c_str(), &err);
+    if (ret != TINYEXR_SUCCESS) {
+        std::cerr << "Could not save EXR: " << (err ? err : path) << std::endl;
+        if (err) FreeEXRErrorMessage(err);
+        return false;
+    }
+
+    std::cout << "Saved EXR: " << path << std::endl;
+    return true;
+}
+
+bool Framebuffer::loadAccumulation(std::string path)
+{
+    EXRVersion version;
+    EXRHeader header;
+    EXRImage image;
+    InitEXRHeader(&header);
+    InitEXRImage(&image);
+    const char* err = nullptr;
+
+    if (ParseEXRVersionFromFile(&version, path.c_str()) != TINYEXR_SUCCESS
+        || ParseEXRHeaderFromFile(&header, &version, path.c_str(), &err) != TINYEXR_SUCCESS) {
+        std::cerr << "Could not read EXR header of " << path << std::endl;
+        if (err) FreeEXRErrorMessage(err);
+        return false;
+    }
+
+    for (int c = 0; c < header.num_channels; c++)
+        header.requested_pixel_types[c] = TINYEXR_PIXELTYPE_FLOAT;
+
+    if (LoadEXRImageFromFile(&image, &header, path.c_str(), &err) != TINYEXR_SUCCESS) {
+        std::cerr << "Could not load EXR " << path << std::endl;
+        if (err) FreeEXRErrorMessage(err);
+        FreeEXRHeader(&header);
+        return false;
+    }
+
+    // Find the channels by name, their order in the file is not fixed
+    int index[numAccumulationChannels];
+    for (int c = 0; c < numAccumulationChannels; c++) {
+        index[c] = -1;
+        for (int i = 0; i < header.num_channels; i++) {
+            if (std::strcmp(header.channels[i].name, accumulationChannels[c]) == 0)
+                index[c] = i;
+        }
+    }
+
+    bool valid = index[3] >= 0 && index[4] >= 0 && index[5] >= 0 && index[6] >= 0;
+    if (valid) {
+        this->allocate(Vector2i(image.width, image.height));
+        const float* count = (const float*)image.images[index[3]];
+        const float* sumB = (const float*)image.images[index[4]];
+        const float* sumG = (const float*)image.images[index[5]];
+        const float* sumR = (const float*)image.images[index[6]];
+
+        for (size_t p = 0; p < this->sampleCount.size(); p++) {
+            this->color[3 * p + 0] = sumR[p];
+            this->color[3 * p + 1] = sumG[p];
+            this->color[3 * p + 2] = sumB[p];
+            this->sampleCount[p] = uint32_t(count[p]);
+        }
+    }
+    else {
+        std::cerr << path << " has no sum.R/G/B and sampleCount channels." << std::endl;
+    }
+
+    FreeEXRImage(&image);
+    FreeEXRHeader(&header);
+    return valid;
+}
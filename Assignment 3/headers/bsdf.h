@@ -24,6 +24,9 @@ class BSDF {
          */
        Vector3f eval(Interaction *si, Vector3f wo);
 
+        size_t memoryUsage();
+        void release();
+
     private:
         Vector3f diffuse;
         float alpha;
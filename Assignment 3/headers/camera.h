@@ -18,4 +18,11 @@ struct Camera {
     Camera(Vector3f from, Vector3f to, Vector3f up, float fieldOfView, Vector2i imageResolution);
 
     Ray generateRay(int x, int y);
+    // Ray through the center of pixel (x, y), no jitter
+    Ray centerRay(int x, int y);
+    // Image position of p in pixels, false if p is behind the camera
+    bool project(Vector3f p, Vector2f& pixel);
+
+    // Copy with any of "from", "to", "up" and "fieldOfView" in changes replaced
+    Camera modified(nlohmann::json changes, Vector2i imageResolution);
 };
\ No newline at end of file
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "framebuffer.h"
+
+// Render settings and scene a checkpoint belongs to. A checkpoint is only
+// resumed by a render with identical settings of the same scene.
+struct CheckpointHeader {
+    char magic[8];
+    uint32_t version;
+    int32_t width, height;
+    int32_t variant;
+    int64_t spp;
+    uint64_t seed;
+    // Scene::contentHash of the rendered scene
+    uint64_t sceneHash;
+    int64_t firstSample;
+    uint32_t adaptive;
+    float threshold;
+    int64_t minSpp;
+    uint32_t hasMoments;
+    // CostMetric of --heatmap, the cost channel is stored unless COST_NONE
+    int32_t costMetric;
+
+    // Slot that holds the most recent complete state, -1 if none
+    int32_t activeSlot;
+    // Number of finished passes stored in each slot
+    int64_t pass[2];
+};
+
+/**
+ * Memory-mapped checkpoint file holding the header and two copies of the
+ * render state (framebuffer sums, sample counts, moments, cost and the adaptive
+ * sampler's active mask). A save always fills the slot that is not active,
+ * syncs it, and only then flips activeSlot, so a crash mid-save leaves the
+ * previous checkpoint intact.
+ */
+struct Checkpoint {
+    std::string path;
+    unsigned char* mapping = nullptr;
+    size_t mappingSize = 0;
+    size_t slotSize = 0;
+
+    ~Checkpoint();
+
+    bool create(std::string path, CheckpointHeader settings);
+    void save(Framebuffer& fb, std::vector<uint8_t>& active, long long pass);
+    void close();
+
+    /**
+     * Restores the latest state of the checkpoint at path into fb/active.
+     * Fails if the file is missing, corrupt or was written with different
+     * settings or for a different scene.
+     *
+     * \return pass
+     * The number of passes the restored state had finished, -1 on failure
+     */
+    static long long load(std::string path, CheckpointHeader settings, Framebuffer& fb, std::vector<uint8_t>& active);
+};
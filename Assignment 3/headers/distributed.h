@@ -0,0 +1,47 @@
+#pragma once
+
+#include "render.h"
+
+enum MessageType {
+    MSG_HELLO = 1,  // worker -> coordinator, on connect
+    MSG_JOB,        // coordinator -> worker, JSON with the scene and render settings
+    MSG_READY,      // worker -> coordinator, scene loaded
+    MSG_LEASE,      // coordinator -> worker, TileLease to render
+    MSG_RESULT,     // worker -> coordinator, TileLease + float sums + sample counts
+    MSG_DONE        // coordinator -> worker, no more work
+};
+
+struct TileLease {
+    int32_t id;
+    int32_t x0, y0, x1, y1;
+};
+
+/**
+ * Coordinator of a distributed render. It only reads the scene description;
+ * workers load the scene themselves, render leased tiles with all samples and
+ * send back their float framebuffer tiles. Leases of workers that disconnect
+ * or exceed leaseTimeout are handed out again.
+ */
+struct Coordinator {
+    std::string address;
+    int tileSize = 32;
+    float leaseTimeout = 120.f;
+
+    // Local worker processes to start, each with workerThreads threads
+    int spawnWorkers = 0;
+    int workerThreads = 0;
+    std::string executable;
+
+    // Appends a JSON line with timing and lease statistics
+    std::string reportPath;
+
+    long long spp;
+    uint64_t seed = 0;
+
+    Framebuffer framebuffer;
+
+    // Returns the render time in microseconds, -1 on failure
+    long long render(std::string pathToJson);
+};
+
+int runWorker(std::string address);
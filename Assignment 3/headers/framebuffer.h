@@ -0,0 +1,81 @@
+#pragma once
+
+#include "common.h"
+#include "texture.h"
+#include "memory.h"
+
+inline float luminance(Vector3f c)
+{
+    return 0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z;
+}
+
+/**
+ * Float accumulation buffer for the integrator. Holds the running radiance
+ * sums and sample counts of every pixel, and optionally the per-pixel second
+ * moment of luminance for variance estimates. Nothing is clamped or encoded
+ * until the final tonemap pass.
+ */
+struct Framebuffer {
+    Vector2i resolution;
+
+    // RGB radiance sums, 3 floats per pixel in scanline order
+    TrackedVector<float, MEM_FRAMEBUFFER> color;
+    TrackedVector<uint32_t, MEM_FRAMEBUFFER> sampleCount;
+    // Sum of squared luminance per pixel, empty unless moments are tracked
+    TrackedVector<float, MEM_FRAMEBUFFER> lumSumSq;
+    // Render cost summed over each pixel's samples, empty unless tracked
+    TrackedVector<float, MEM_FRAMEBUFFER> cost;
+
+    void allocate(Vector2i resolution);
+    void trackMoments();
+    bool hasMoments() { return !this->lumSumSq.empty(); }
+    void trackCost();
+    bool hasCost() { return !this->cost.empty(); }
+    void clear();
+
+    int pixelIndex(int x, int y) { return y * this->resolution.x + x; }
+
+    void addSample(int p, Vector3f value)
+    {
+        this->color[3 * p + 0] += value.x;
+        this->color[3 * p + 1] += value.y;
+        this->color[3 * p + 2] += value.z;
+        this->sampleCount[p] += 1;
+        if (this->hasMoments()) {
+            float lum = luminance(value);
+            this->lumSumSq[p] += lum * lum;
+        }
+    }
+
+    // Adds the sums and counts of tile, whose pixel (0, 0) is pixel origin here
+    void addTile(Framebuffer& tile, Vector2i origin);
+    // Copy of the size pixels starting at origin
+    Framebuffer crop(Vector2i origin, Vector2i size);
+
+    Vector3f mean(int p);
+    float relativeError(int p);
+    // Root mean squared difference of the pixel means to reference
+    float rmse(Framebuffer& reference);
+    // Mean of (value - reference)^2 / (reference^2 + 0.01) over pixels and channels
+    float relMse(Framebuffer& reference);
+
+    // Tonemap/encode stage
+    void tonemap(Texture& out);
+    void resolve(Texture& out);
+
+    void save(std::string path);
+    void saveSampleCounts(std::string path);
+    /**
+     * Writes the cost per sample of every pixel as <stem>_cost.exr and as a
+     * false color <stem>_cost.png scaled to the 99th percentile.
+     */
+    void saveCost(std::string stem);
+
+    /**
+     * Float EXR holding the pixel means (R, G, B) for viewing, together with
+     * the exact radiance sums (sum.R, sum.G, sum.B) and sampleCount needed
+     * to merge partial renders.
+     */
+    bool saveAccumulation(std::string path);
+    bool loadAccumulation(std::string path);
+};
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <vector>
+
+enum MemoryCategory {
+    MEM_GEOMETRY = 0,   // Surface vertices, normals, uvs and indices
+    MEM_TRIANGLES,      // Surface triNormals and triIdxs, per-triangle data used for intersection
+    MEM_BVH,            // scene and surface BVH nodes
+    MEM_TEXTURES,
+    MEM_FRAMEBUFFER,    // accumulation buffers
+    NUM_MEMORY_CATEGORIES
+};
+
+/**
+ * Bytes currently allocated and the peak of every category, updated by
+ * TrackedAllocator and trackedMalloc/trackedFree. With a budget set, an
+ * allocation that takes the total above it prints the breakdown and exits,
+ * before the system runs out of memory.
+ */
+struct MemoryStats {
+    static void allocate(MemoryCategory category, size_t bytes);
+    static void deallocate(MemoryCategory category, size_t bytes);
+
+    static size_t current(MemoryCategory category);
+    static size_t peak(MemoryCategory category);
+    static size_t total();
+    static size_t peakTotal();
+
+    // 0 disables the budget
+    static void setBudget(size_t bytes);
+
+    /** Prints the bytes and peak of every category and the peak RSS, labelled with when. */
+    static void print(std::string when, std::ostream& out);
+};
+
+// Peak resident set size of the process in bytes, 0 where unsupported
+size_t peakRssBytes();
+
+// malloc and free that count towards a category, trackedFree takes nullptr too
+void* trackedMalloc(MemoryCategory category, size_t bytes);
+void trackedFree(MemoryCategory category, void* data);
+
+template <typename T, MemoryCategory category>
+struct TrackedAllocator {
+    typedef T value_type;
+    template <typename U> struct rebind { typedef TrackedAllocator<U, category> other; };
+
+    TrackedAllocator() {}
+    template <typename U> TrackedAllocator(const TrackedAllocator<U, category>&) {}
+
+    T* allocate(size_t n)
+    {
+        MemoryStats::allocate(category, n * sizeof(T));
+        return std::allocator<T>().allocate(n);
+    }
+    void deallocate(T* data, size_t n)
+    {
+        MemoryStats::deallocate(category, n * sizeof(T));
+        std::allocator<T>().deallocate(data, n);
+    }
+
+    template <typename U> bool operator==(const TrackedAllocator<U, category>&) const { return true; }
+    template <typename U> bool operator!=(const TrackedAllocator<U, category>&) const { return false; }
+};
+
+// std::vector whose capacity counts towards a memory category
+template <typename T, MemoryCategory category>
+using TrackedVector = std::vector<T, TrackedAllocator<T, category>>;
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Message framing used between render processes: a fixed header followed by
+// size bytes of payload. Peers are assumed to share the same endianness.
+struct MessageHeader {
+    uint32_t type;
+    uint32_t size;
+};
+
+/**
+ * Addresses are either "unix:<path>" for a Unix domain socket or
+ * "<host>:<port>" for TCP. An empty host listens on every interface, or on
+ * 127.0.0.1 if loopbackOnly is set, which also rejects TCP
+ * hosts that are not loopback addresses.
+ *
+ * \return fd
+ * The socket file descriptor, -1 on failure
+ */
+int listenSocket(std::string address, bool loopbackOnly);
+int acceptSocket(int listenFd);
+int connectSocket(std::string address);
+void closeSocket(int fd);
+void setReceiveTimeout(int fd, float seconds);
+
+bool sendAll(int fd, const void* data, size_t size);
+bool recvAll(int fd, void* data, size_t size);
+
+bool sendMessage(int fd, uint32_t type, const void* payload, size_t size);
+bool sendMessage(int fd, uint32_t type, const std::string& payload);
+bool recvMessage(int fd, uint32_t& type, std::vector<char>& payload);
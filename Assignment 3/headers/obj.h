@@ -0,0 +1,43 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "tinyobjloader/tiny_obj_loader.h"
+
+// Contents of an OBJ file in tinyobjloader's layout
+struct ObjFile {
+    tinyobj::attrib_t attrib;
+    std::vector<tinyobj::shape_t> shapes;
+    std::vector<tinyobj::material_t> materials;
+    // Names on the file's mtllib lines, relative to the OBJ's directory
+    std::vector<std::string> materialLibraries;
+};
+
+enum ObjParser {
+    OBJ_PARSER_FAST = 0,    // loadObjFast, falling back to tinyobjloader
+    OBJ_PARSER_TINYOBJ
+};
+
+// Parser used by loadObj
+extern ObjParser objParser;
+
+/** Loads an OBJ file with objParser. Exits if the file cannot be parsed. */
+void loadObj(std::string pathToObj, ObjFile& obj);
+
+/** tinyobjloader's ObjReader, exits if the file cannot be parsed. */
+void loadObjTinyobj(std::string pathToObj, ObjFile& obj);
+
+/**
+ * Parser for triangle meshes. The file is memory mapped and split at line
+ * boundaries into chunks that are parsed in parallel, and the vertex counts
+ * of earlier chunks are added afterwards to resolve relative indices.
+ * Vertices, indices, shapes and materials come out exactly as with
+ * tinyobjloader, vertex colors and smoothing groups are not read.
+ *
+ * \return
+ * false for files using anything the fast path does not handle (polygons,
+ * lines, points, unusual number formats, invalid indices), which are left
+ * to tinyobjloader
+ */
+bool loadObjFast(std::string pathToObj, ObjFile& obj);
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+
+// Number of worker threads used by parallelFor (defaults to the hardware concurrency)
+int getNumThreads();
+void setNumThreads(int n);
+
+/**
+ * Runs func(begin, end) over [start, stop) split into chunks of at most
+ * chunkSize items, distributed dynamically over the worker threads.
+ * Returns once every chunk has been processed. A parallelFor called from
+ * inside another one runs on the calling thread.
+ */
+void parallelFor(int start, int stop, int chunkSize, const std::function<void(int, int)>& func);
+
+/**
+ * Tasks that can add further tasks while they run, e.g. a parsed file adding
+ * a task per shape. run only queues; wait executes the queue on the calling
+ * thread and getNumThreads() - 1 helpers until every task, including those
+ * added meanwhile, has finished. A wait inside parallelFor or another task
+ * group runs everything on the calling thread. If a task throws, the
+ * remaining tasks still run and wait rethrows the first exception.
+ */
+struct TaskGroup {
+    void run(std::function<void()> task);
+    void wait();
+
+private:
+    void work();
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<std::function<void()>> queue;
+    int pending = 0;
+    std::exception_ptr error;
+};
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "json/include/nlohmann/json.hpp"
+
+enum PerfEvent {
+    PERF_CYCLES = 0,
+    PERF_INSTRUCTIONS,
+    PERF_L1D_MISSES,        // L1 data cache read misses
+    PERF_LLC_MISSES,        // last level cache misses
+    PERF_BRANCH_MISSES,
+    PERF_DTLB_MISSES,       // data TLB read misses
+    NUM_PERF_EVENTS
+};
+
+/**
+ * Hardware counters of the calling thread and of the threads it starts while
+ * the counters are open (Linux perf_event_open, user space only). Threads
+ * started by parallelFor are joined before a phase ends, so a phase counts
+ * all of its work. Counters the kernel or container does not allow are
+ * reported as missing, and everything else keeps working without them.
+ */
+struct PerfCounters {
+    PerfCounters();
+    ~PerfCounters();
+
+    /** Opens every counter, returns false (and sets error) if none is available. */
+    bool open();
+    bool available();
+    std::string error;
+
+    // Counts of one phase, scaled up when the kernel had to multiplex counters
+    struct Phase {
+        uint64_t values[NUM_PERF_EVENTS] = {};
+        bool valid[NUM_PERF_EVENTS] = {};
+    };
+
+    void start();
+    Phase stop();
+
+    /** Counts of a phase, plus each count divided by every nonzero entry of perUnit (e.g. "perRay"). */
+    static nlohmann::json toJson(const Phase& phase, std::vector<std::pair<std::string, double>> perUnit);
+
+private:
+    int fds[NUM_PERF_EVENTS];
+    // Raw count, time enabled and time running at start()
+    uint64_t baseline[NUM_PERF_EVENTS][3];
+    bool read(int event, uint64_t result[3]);
+};
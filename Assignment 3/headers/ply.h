@@ -0,0 +1,20 @@
+#pragma once
+
+#include "surface.h"
+
+/**
+ * Loads a PLY mesh (ascii, binary_little_endian or binary_big_endian) into
+ * the geometry of surf. Vertices need x, y and z, and may have nx, ny, nz
+ * and texture coordinates (u/v, s/t or texture_u/texture_v). Faces are
+ * lists named vertex_indices or vertex_index, polygons are split into fans.
+ * Binary files are memory mapped, and vertex records are copied from the
+ * mapping straight into the surface's shared vertex buffers. Faces without
+ * vertex normals get the geometric normal.
+ *
+ * \return
+ * false after printing the reason if the file cannot be read
+ */
+bool loadPly(std::string pathToPly, Surface& surf);
+
+// Whether the path ends in .ply (any case)
+bool isPlyPath(const std::string& path);
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "render.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+/**
+ * Progressive preview of a loaded scene for interactive camera placement.
+ * Renders 1 spp at 1/8, 1/4 and 1/2 resolution, upsampled to the full frame,
+ * then refines at full resolution one sample per pixel per pass up to maxSpp.
+ * setCamera abandons the current image and starts over with the new camera.
+ *
+ * Every stage is handed to onImage from the render thread: the image, the
+ * stage's downscale factor (1 for full resolution refinement), the spp of
+ * the stage and the milliseconds since the camera was set.
+ */
+struct PreviewSession {
+    using ImageCallback = std::function<void(Framebuffer& image, int scale, long long spp, double ms)>;
+
+    PreviewSession(Scene& scene, long long maxSpp, ImageCallback onImage);
+    ~PreviewSession();
+
+    void setCamera(Camera camera);
+    // Blocks until the current camera has been refined to maxSpp
+    void waitUntilDone();
+    void stop();
+
+    Scene& scene;
+    long long maxSpp;
+    uint64_t seed = 0;
+    ImageCallback onImage;
+
+    // Milliseconds from each setCamera to the first image, in order
+    std::vector<double> timesToFirstImage;
+
+private:
+    void run();
+    bool renderStage(Integrator& integrator, Framebuffer& image, long long sampleIndex, uint64_t generation);
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable changed;
+    Camera camera;
+    // Bumped by every setCamera, a stage is abandoned once it changes
+    std::atomic<uint64_t> generation;
+    uint64_t doneGeneration = 0;
+    bool hasCamera = false;
+    bool stopping = false;
+};
+
+// Reads JSON camera changes from stdin and keeps outPath updated
+int runPreview(Scene& scene, std::string outPath, long long maxSpp, uint64_t seed);
@@ -1,10 +1,44 @@
 #pragma once
 
+#include <cstdint>
 #include <cstdlib>
 #include <limits>
 
+// Per-thread PCG32 state (https://www.pcg-random.org).
+// The integrator reseeds it before every sample with seed_random, so the
+// numbers a sample draws depend only on (seed, pixel, sample index) and not on
+// the thread or the order in which samples are taken.
+inline uint64_t& random_state() {
+    static thread_local uint64_t state = 0x853c49e6748fea9bULL;
+    return state;
+}
+
+inline uint64_t mix_bits(uint64_t v) {
+    // splitmix64 finalizer
+    v ^= v >> 30;
+    v *= 0xbf58476d1ce4e5b9ULL;
+    v ^= v >> 27;
+    v *= 0x94d049bb133111ebULL;
+    v ^= v >> 31;
+    return v;
+}
+
+inline void seed_random(uint64_t seed, uint64_t pixel, uint64_t sampleIndex) {
+    random_state() = mix_bits(mix_bits(seed ^ mix_bits(pixel)) + sampleIndex);
+}
+
+inline uint32_t next_uint() {
+    uint64_t& state = random_state();
+    uint64_t old = state;
+    state = old * 6364136223846793005ULL + 1442695040888963407ULL;
+    uint32_t xorshifted = uint32_t(((old >> 18u) ^ old) >> 27u);
+    uint32_t rot = uint32_t(old >> 59u);
+    return (xorshifted >> rot) | (xorshifted << ((~rot + 1u) & 31));
+}
+
 // Utility Functions
 inline float next_float() {
     // Returns a random real in [0,1).
-    return (float)(rand() / (RAND_MAX + 1.0));
-}
\ No newline at end of file
+    float v = next_uint() * 2.3283064365386963e-10f; // 2^-32
+    return v < 1.f ? v : 0.99999994f;
+}
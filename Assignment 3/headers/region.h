@@ -0,0 +1,40 @@
+#pragma once
+
+#include "framebuffer.h"
+
+/**
+ * Region of interest: the union of crop rectangles and mask images. Only
+ * the pixels inside it are traced. Rectangles are given in pixels or in
+ * normalized [0, 1] image coordinates, masks are images whose non-black
+ * pixels are part of the region.
+ */
+struct Region {
+    struct Rect {
+        float x0, y0, x1, y1;
+        bool normalized;
+    };
+    std::vector<Rect> rects;
+    std::vector<std::string> maskPaths;
+
+    // Write only the bounding box of the region instead of the full frame
+    bool cropOutput = false;
+    // Float image whose pixels outside the region are kept in the output
+    std::string compositePath;
+
+    // One entry per image pixel, filled by build
+    Vector2i resolution;
+    std::vector<uint8_t> mask;
+    Vector2i lower, upper;
+
+    bool enabled() { return !this->rects.empty() || !this->maskPaths.empty(); }
+
+    /** Rasterizes the rectangles and masks for an image of the given resolution. */
+    bool build(Vector2i resolution);
+    long long numPixels();
+
+    /**
+     * Saves the rendered frame to path: cropped to the bounding box,
+     * composited over compositePath, or as the full frame.
+     */
+    bool save(Framebuffer& framebuffer, std::string path);
+};
@@ -1,12 +1,60 @@
 #pragma once
 
 #include "scene.h"
+#include "framebuffer.h"
+
+struct CheckpointHeader;
+
+// Sampling strategy, see Integrator::samplePixel
+extern int variant;
+
+// What the per-pixel cost AOV measures
+enum CostMetric {
+    COST_NONE = 0,
+    COST_TIME,       // wall time in microseconds
+    COST_TRAVERSAL   // BVH nodes visited plus triangle tests, needs RENDER_STATS
+};
 
 struct Integrator {
     Integrator(Scene& scene);
 
+    // Returns the render time in microseconds, -1 if the checkpoint to
+    // resume from or to save to cannot be used
     long long render();
+    void renderTile(Framebuffer& tile, Vector2i origin);
+    Vector3f samplePixel(int x, int y);
+
     long long spp;
-    Scene scene;
-    Texture outputImage;
-};
\ No newline at end of file
+    Scene& scene;
+    // Camera used for rendering, the scene's camera unless overridden
+    Camera camera;
+    Framebuffer framebuffer;
+
+    // Adaptive sampling: when enabled, spp is the per-pixel maximum and pixels
+    // stop receiving samples once their relative error drops below threshold.
+    bool adaptive = false;
+    long long minSpp = 16;
+    float threshold = 0.05f;
+
+    // Seed of the per-(pixel, sample) random streams
+    uint64_t seed = 0;
+    // Index of the first sample taken per pixel. A shard of a render takes
+    // samples [firstSample, firstSample + spp).
+    long long firstSample = 0;
+
+    // Pixels to trace, one entry per image pixel. Empty traces every pixel.
+    std::vector<uint8_t> mask;
+
+    // Records the cost of every pixel into framebuffer.cost when set
+    CostMetric costMetric = COST_NONE;
+
+    // Checkpointing: the render state is saved to checkpointPath after a pass
+    // once checkpointInterval seconds have passed since the last save. Passes
+    // grow until they take about a tenth of checkpointInterval.
+    std::string checkpointPath;
+    float checkpointInterval = 300.f;
+    std::string resumePath;
+    CheckpointHeader checkpointSettings();
+
+    int numAreaLights = 0;
+};
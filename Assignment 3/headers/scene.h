@@ -4,22 +4,95 @@
 #include "surface.h"
 #include "light.h"
 
+// A file the scene was built from, compared by size and modification time
+struct FileStamp {
+    std::string path;
+    long long size = -1;
+    long long mtime = -1;
+
+    static FileStamp of(std::string path);
+};
+
+// The surfaces loaded from one entry of the scene's "surface" list
+struct SurfaceSource {
+    std::string path;
+    // OBJ, MTL libraries and textures
+    std::vector<FileStamp> files;
+    uint32_t count = 0;
+    bool reused = false;
+
+    bool unchanged();
+};
+
+// What Scene::reload had to redo
+struct ReloadStats {
+    bool cameras = false;
+    bool lights = false;
+    int reparsedFiles = 0;
+    int keptFiles = 0;
+    bool bvhRefit = false;
+    bool bvhRebuilt = false;
+
+    bool changed() { return this->cameras || this->lights || this->reparsedFiles > 0 || this->bvhRebuilt; }
+};
+
+// Time to load a scene, the stage times are summed over all loading threads
+struct LoadStats {
+    int meshFiles = 0;
+    int textures = 0;
+    float parseMs = 0.f;
+    float geometryMs = 0.f;
+    float textureMs = 0.f;
+    float bvhMs = 0.f;
+    float topLevelBvhMs = 0.f;
+    float wallMs = 0.f;
+
+    void print();
+};
+
 struct Scene {
     std::vector<Surface> surfaces;
     std::vector<uint32_t> surfaceIdxs;
     std::vector<Light> lights;
     Camera camera;
+    // Every camera of the scene ("cameras" list or "turntable" frames), camera is the first
+    std::vector<Camera> cameras;
     Vector2i imageResolution;
 
     AABB bbox;
-    BVHNode* nodes;
+    BVHNode* nodes = nullptr;
     int numBVHNodes = 0;
+    // Wall time of the last buildBVH, without the surfaces' own BVHs
+    float bvhBuildMs = 0.f;
 
     Scene() {};
+    // Both throw a std::exception with the reason if the scene cannot be loaded
     Scene(std::string sceneDirectory, std::string sceneJson);
     Scene(std::string pathToJson);
+    // Scenes are shared by reference, see Surface
+    Scene(const Scene&) = delete;
+    Scene& operator=(const Scene&) = delete;
+    Scene(Scene&& other);
+    Scene& operator=(Scene&& other);
     
     void parse(std::string sceneDirectory, nlohmann::json sceneConfig);
+    bool parseCameras(nlohmann::json sceneConfig);
+    bool parseLights(nlohmann::json sceneConfig);
+    int parseSurfaces(nlohmann::json sceneConfig, std::vector<Surface>* previousSurfaces);
+
+    // Dependency tracking for reload, configPath is empty for scenes parsed from a string
+    std::string configPath, sceneDirectory;
+    std::vector<SurfaceSource> sources;
+    size_t cameraHash = 0, lightHash = 0, surfaceListHash = 0;
+
+    LoadStats loadStats;
+
+    // Hash of the scene config sections and the size and modification time
+    // of every file the surfaces were loaded from
+    uint64_t contentHash();
+
+    ReloadStats reload();
+    void refitBVH();
 
     void buildBVH();
     uint32_t getIdx(uint32_t idx);
@@ -29,4 +102,7 @@ struct Scene {
 
     Interaction rayIntersect(Ray& ray);
     Interaction rayEmitterIntersect(Ray& ray);
+
+    size_t memoryUsage();
+    void release();
 };
\ No newline at end of file
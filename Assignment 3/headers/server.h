@@ -0,0 +1,60 @@
+#pragma once
+
+#include "render.h"
+
+#include <list>
+#include <memory>
+
+enum ServerMessageType {
+    MSG_RENDER_REQUEST = 16,  // client -> server, JSON request
+    MSG_RENDER_REPLY,         // server -> client, JSON with image size and timings
+    MSG_RENDER_IMAGE          // server -> client, float RGB pixel means
+};
+
+/**
+ * Loaded scenes kept in memory, most recently used first. Scenes are evicted
+ * from the back once their estimated size exceeds budget bytes; the scene
+ * that was just requested always stays. Cached scenes are reloaded
+ * incrementally when their files change.
+ */
+struct SceneCache {
+    struct Entry {
+        std::string path;
+        std::unique_ptr<Scene> scene;
+        size_t bytes;
+    };
+
+    size_t budget = size_t(4) << 30;
+    size_t totalBytes = 0;
+    std::list<Entry> entries;
+
+    ~SceneCache();
+
+    // Returns nullptr with the reason in error if the scene cannot be loaded
+    Scene* get(std::string path, bool& hit, ReloadStats& stats, std::string& error);
+    void evict();
+};
+
+/**
+ * Long-running render process that keeps scenes warm between requests.
+ * A request is a JSON object:
+ *   "scene"       path to the scene config (required)
+ *   "spp", "variant", "seed"
+ *   "resolution"  [w, h], defaults to the scene's
+ *   "camera"      any of "from", "to", "up", "fieldOfView" to override
+ *   "crop"        [x0, y0, x1, y1] pixel window to render
+ *   "command"     "stats" or "shutdown" instead of a render
+ */
+struct RenderServer {
+    std::string address;
+    SceneCache cache;
+
+    int run();
+    nlohmann::json handle(nlohmann::json request, Framebuffer& image);
+};
+
+/**
+ * Stand-in client: sends the request in requestPath repeat times, reports the
+ * latency percentiles of the warm requests and saves the last image.
+ */
+int runClient(std::string address, std::string requestPath, std::string outPath, int repeat);
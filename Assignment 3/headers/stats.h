@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#ifndef RENDER_STATS
+#define RENDER_STATS 0
+#endif
+
+enum StatCounter {
+    STAT_CAMERA_RAYS = 0,
+    STAT_SHADOW_RAYS,       // rays towards a sampled light position
+    STAT_SECONDARY_RAYS,    // rays in sampled hemisphere directions
+    STAT_BVH_NODES,         // scene and surface BVH nodes whose box the ray hits
+    STAT_AABB_TESTS,
+    STAT_TRIANGLE_TESTS,
+    STAT_HITS,              // Scene::rayIntersect calls that hit a surface
+    STAT_MISSES,
+    NUM_STAT_COUNTERS
+};
+
+/**
+ * Ray and traversal counters. Every thread counts into its own copy, which
+ * is added to the global totals when the thread exits, so counting costs a
+ * thread local increment and no synchronization. With RENDER_STATS=0 the
+ * STAT_INC calls compile to nothing.
+ */
+struct RenderStats {
+    uint64_t counters[NUM_STAT_COUNTERS] = {};
+
+    uint64_t rays() { return this->counters[STAT_CAMERA_RAYS] + this->counters[STAT_SHADOW_RAYS] + this->counters[STAT_SECONDARY_RAYS]; }
+    void add(const RenderStats& other);
+
+    /** Totals of all exited threads plus the calling thread. */
+    static RenderStats collect();
+    static void reset();
+
+    /** Writes the counters and rays per second of a render that took seconds. */
+    bool writeJson(std::string path, double seconds);
+};
+
+#if RENDER_STATS
+struct ThreadStats : RenderStats {
+    ~ThreadStats();
+};
+
+inline ThreadStats& threadStats()
+{
+    static thread_local ThreadStats stats;
+    return stats;
+}
+
+#define STAT_INC(counter) (threadStats().counters[counter]++)
+#else
+#define STAT_INC(counter) ((void)0)
+#endif
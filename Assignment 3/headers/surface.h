@@ -3,32 +3,100 @@
 #include "common.h"
 #include "texture.h"
 #include "bsdf.h"
+#include "memory.h"
 
-struct Tri {
-    Vector3f v1, v2, v3;
-    Vector2f uv1, uv2, uv3;
-    Vector3f normal;
-    Vector3f centroid;
-    
-    AABB bbox;
+#include <atomic>
+
+struct TaskGroup;
+
+// Storage of vertex attributes, see Surface::encodeVertices
+enum VertexEncoding {
+    VERTEX_FLOAT = 0,           // 32-bit floats
+    VERTEX_COMPACT,             // 2x16-bit uvs
+    VERTEX_COMPACT_POSITIONS    // also 3x16-bit positions within the surface bounds
+};
+
+// Encoding of the surfaces of loaded scenes
+extern VertexEncoding vertexEncoding;
+
+struct PackedPosition {
+    uint16_t x, y, z;
 };
 
 struct Surface {
-    std::vector<Vector3f> vertices, normals;
-    std::vector<Vector3i> indices;
-    std::vector<Vector2f> uvs;
+    // Vertex attributes shared by the triangles. normals and uvs are either
+    // empty or hold one entry per vertex. Normals are only held until
+    // encodeVertices, they give the triangle normals. Without them,
+    // triangles are shaded with their geometric normal.
+    TrackedVector<Vector3f, MEM_GEOMETRY> vertices, normals;
+    TrackedVector<Vector2f, MEM_GEOMETRY> uvs;
+    // Vertex indices of every triangle
+    TrackedVector<Vector3i, MEM_GEOMETRY> indices;
+
+    // After encodeVertices, compressed attributes replace the float buffers
+    // above. Positions and uvs decode to offset + value * scale.
+    VertexEncoding encoding = VERTEX_FLOAT;
+    TrackedVector<PackedPosition, MEM_GEOMETRY> packedVertices;
+    TrackedVector<uint32_t, MEM_GEOMETRY> packedUvs;
+    Vector3f positionOffset, positionScale;
+    Vector2f uvOffset, uvScale;
 
-    BVHNode* nodes;
+    BVHNode* nodes = nullptr;
     int numBVHNodes = 0;
+    // Wall time of the last buildBVH
+    float bvhBuildMs = 0.f;
 
-    std::vector<Tri> tris;
-    std::vector<uint32_t> triIdxs;
+    // Plane normal of every triangle for the intersection test and shading, the
+    // normalized sum of its vertex normals
+    TrackedVector<Vector3f, MEM_TRIANGLES> triNormals;
+    TrackedVector<uint32_t, MEM_TRIANGLES> triIdxs;
+    // Triangle centroids, only held while the BVH is built
+    TrackedVector<Vector3f, MEM_BVH> centroids;
     AABB bbox;
     BSDF bsdf;
 
     bool isLight;
     uint32_t shapeIdx;
 
+    Surface() {};
+    // Surfaces are only moved: a copy would duplicate the vertex buffers and
+    // share the BVH nodes and textures that release() frees
+    Surface(const Surface&) = delete;
+    Surface& operator=(const Surface&) = delete;
+    Surface(Surface&& other);
+    Surface& operator=(Surface&& other);
+
+    void addTriangle(Vector3f vertices[3], Vector3f normals[3], Vector2f uvs[3]);
+    void addTriangle(Vector3i index);
+    // Reserves space for numTriangles more triangles
+    void reserve(size_t numTriangles);
+    size_t numTriangles() const { return this->indices.size(); }
+    void encodeVertices(VertexEncoding encoding);
+
+    // Attributes of a vertex in either encoding
+    size_t numVertices() const { return this->packedVertices.empty() ? this->vertices.size() : this->packedVertices.size(); }
+    bool hasNormals() const { return !this->normals.empty(); }
+    bool hasUvs() const { return !this->uvs.empty() || !this->packedUvs.empty(); }
+    inline Vector3f position(int vertex) const
+    {
+        if (this->packedVertices.empty())
+            return this->vertices[vertex];
+        const PackedPosition& p = this->packedVertices[vertex];
+        return Vector3f(
+            this->positionOffset.x + p.x * this->positionScale.x,
+            this->positionOffset.y + p.y * this->positionScale.y,
+            this->positionOffset.z + p.z * this->positionScale.z);
+    }
+    inline Vector2f uv(int vertex) const
+    {
+        if (this->packedUvs.empty())
+            return this->uvs[vertex];
+        uint32_t packed = this->packedUvs[vertex];
+        return Vector2f(
+            this->uvOffset.x + (packed & 0xffff) * this->uvScale.x,
+            this->uvOffset.y + (packed >> 16) * this->uvScale.y);
+    }
+
     void buildBVH();
     uint32_t getIdx(uint32_t idx);
     void updateNodeBounds(uint32_t nodeIdx);
@@ -38,6 +106,30 @@ struct Surface {
     Interaction rayPlaneIntersect(Ray ray, Vector3f p, Vector3f n);
     Interaction rayTriangleIntersect(Ray ray, Vector3f v1, Vector3f v2, Vector3f v3, Vector3f n);
     Interaction rayIntersect(Ray& ray);
+
+    size_t memoryUsage();
+    void release();
 };
 
-std::vector<Surface> createSurfaces(std::string pathToObj, bool isLight, uint32_t shapeIdx);
\ No newline at end of file
+// Time spent in each loading stage in microseconds, summed over all threads
+struct LoadTimes {
+    std::atomic<long long> parse{ 0 }, geometry{ 0 }, textures{ 0 }, bvh{ 0 };
+    std::atomic<int> numTextures{ 0 };
+};
+
+/**
+ * Loads every shape of an OBJ file as a surface with its own BVH. A PLY file
+ * (see headers/ply.h) becomes a single white diffuse surface. If
+ * dependencies is given, the paths of the OBJ, its material libraries and
+ * its textures are appended to it. Throws std::runtime_error if a file
+ * cannot be loaded.
+ */
+std::vector<Surface> createSurfaces(std::string pathToObj, bool isLight, uint32_t shapeIdx, std::vector<std::string>* dependencies = nullptr);
+
+/**
+ * Same as createSurfaces, but only parses the OBJ and fills in the geometry
+ * of surfaces. Texture decoding and the BVH build of every surface are added
+ * to tasks, which has to finish before surfaces is used or resized.
+ */
+void loadSurfaces(std::string pathToObj, bool isLight, uint32_t shapeIdx, std::vector<std::string>* dependencies,
+    std::vector<Surface>& surfaces, TaskGroup& tasks, LoadTimes& times);
\ No newline at end of file
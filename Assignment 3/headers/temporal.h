@@ -0,0 +1,39 @@
+#pragma once
+
+#include "framebuffer.h"
+#include "scene.h"
+
+/**
+ * Reuses the accumulated radiance of the previous frame of a camera sequence
+ * over a static scene. The first hit of every pixel's center ray is projected
+ * into the previous frame; the pixel it lands on is reused when it saw a
+ * surface at a similar distance with a similar normal. Reused pixels keep at
+ * most (1 - refreshFraction) * spp samples of history so that new samples
+ * still go into every pixel, disoccluded pixels start from zero.
+ */
+struct TemporalCache {
+    // Allowed relative difference of the distance to the previous camera
+    float depthTolerance = 0.02f;
+    // Minimum cosine between the normals
+    float normalTolerance = 0.9f;
+    float refreshFraction = 0.25f;
+
+    bool hasHistory = false;
+    Camera camera;
+    // First hit position and normal per pixel, hit is 0 where there is none
+    std::vector<Vector3f> position, normal;
+    std::vector<uint8_t> hit;
+    Framebuffer history;
+
+    /**
+     * Computes the first hits seen by camera and fills framebuffer with the
+     * reprojected history. Returns the number of reused pixels.
+     */
+    long long reproject(Scene& scene, Camera camera, long long spp, Framebuffer& framebuffer);
+    // Keeps the finished frame as history for the next one
+    void store(Framebuffer& framebuffer);
+
+private:
+    std::vector<Vector3f> nextPosition, nextNormal;
+    std::vector<uint8_t> nextHit;
+};
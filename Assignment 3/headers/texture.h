@@ -8,6 +8,11 @@ enum TextureType {
     NUM_TEXTURE_TYPES
 };
 
+// Gamma 2.2 encode clamped to [0, 1]
+float gammaTransform(float val);
+// 8-bit gamma encode through a lookup table, matches gammaTransform(val) * 255
+uint32_t gammaEncode(float val);
+
 struct Texture {
     unsigned long long data = 0;
     TextureType type;
@@ -26,6 +31,9 @@ struct Texture {
     void loadPng(std::string pathToPng);
     void loadExr(std::string pathToExr);
         
+    size_t memoryUsage();
+    void release();
+
     void save(std::string path);
     void saveExr(std::string path);
     void savePng(std::string path);
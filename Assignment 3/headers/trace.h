@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+/**
+ * Scoped timers that record Chrome trace events (chrome://tracing, Perfetto).
+ * Tracing is off unless a TraceSession is alive, in which case every
+ * TRACE_SCOPE records a complete event with the thread it ran on. Events are
+ * buffered per thread and collected when threads exit, so recording does not
+ * take locks.
+ */
+struct TraceScope {
+    TraceScope(const char* name);
+    TraceScope(const char* name, const std::string& detail);
+    ~TraceScope();
+
+    const char* name;
+    std::string detail;
+    int64_t start;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(...) TraceScope TRACE_CONCAT(traceScope, __LINE__)(__VA_ARGS__)
+
+// Labels the calling thread in the trace, e.g. "worker 3"
+void setTraceThread(int id, std::string name);
+
+struct TraceSession {
+    TraceSession(std::string path);
+    // Writes the trace file
+    ~TraceSession();
+
+    std::string path;
+};
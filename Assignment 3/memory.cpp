@@ -0,0 +1,127 @@
+#include "memory.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+static const char* categoryNames[NUM_MEMORY_CATEGORIES] = {
+    "geometry", "triangles", "bvh", "textures", "framebuffer"
+};
+
+static std::atomic<size_t> currentBytes[NUM_MEMORY_CATEGORIES];
+static std::atomic<size_t> peakBytes[NUM_MEMORY_CATEGORIES];
+static std::atomic<size_t> totalBytes(0), peakTotalBytes(0);
+static size_t budget = 0;
+
+static void updatePeak(std::atomic<size_t>& peak, size_t value)
+{
+    size_t previous = peak.load();
+    while (value > previous && !peak.compare_exchange_weak(previous, value)) {}
+}
+
+void MemoryStats::allocate(MemoryCategory category, size_t bytes)
+{
+    updatePeak(peakBytes[category], currentBytes[category] += bytes);
+    size_t total = totalBytes += bytes;
+    updatePeak(peakTotalBytes, total);
+
+    if (budget > 0 && total > budget) {
+        // Only the first thread over the budget reports
+        static std::mutex exitMutex;
+        exitMutex.lock();
+        std::cerr << "Memory budget of " << budget / (1024.0 * 1024.0) << " MB exceeded by an allocation of "
+            << bytes / (1024.0 * 1024.0) << " MB for " << categoryNames[category] << std::endl;
+        MemoryStats::print("at budget", std::cerr);
+        exit(1);
+    }
+}
+
+void MemoryStats::deallocate(MemoryCategory category, size_t bytes)
+{
+    currentBytes[category] -= bytes;
+    totalBytes -= bytes;
+}
+
+size_t MemoryStats::current(MemoryCategory category)
+{
+    return currentBytes[category];
+}
+
+size_t MemoryStats::peak(MemoryCategory category)
+{
+    return peakBytes[category];
+}
+
+size_t MemoryStats::total()
+{
+    return totalBytes;
+}
+
+size_t MemoryStats::peakTotal()
+{
+    return peakTotalBytes;
+}
+
+void MemoryStats::setBudget(size_t bytes)
+{
+    budget = bytes;
+}
+
+void MemoryStats::print(std::string when, std::ostream& out)
+{
+    auto mb = [](size_t bytes) {
+        char text[32];
+        snprintf(text, sizeof(text), "%10.2f MB", bytes / (1024.0 * 1024.0));
+        return std::string(text);
+    };
+    out << "Memory " << when << ":" << std::endl;
+    for (int c = 0; c < NUM_MEMORY_CATEGORIES; c++) {
+        out << "  " << categoryNames[c] << std::string(12 - std::string(categoryNames[c]).size(), ' ')
+            << mb(currentBytes[c]) << " (peak " << mb(peakBytes[c]) << ")" << std::endl;
+    }
+    out << "  tracked     " << mb(totalBytes) << " (peak " << mb(peakTotalBytes) << ")" << std::endl;
+    out << "  peak RSS    " << mb(peakRssBytes()) << std::endl;
+}
+
+size_t peakRssBytes()
+{
+#ifndef _WIN32
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#ifdef __APPLE__
+        return size_t(usage.ru_maxrss);
+#else
+        return size_t(usage.ru_maxrss) * 1024;
+#endif
+    }
+#endif
+    return 0;
+}
+
+// The size is stored in front of the block, which stays 16 byte aligned
+static const size_t headerSize = 16;
+
+void* trackedMalloc(MemoryCategory category, size_t bytes)
+{
+    MemoryStats::allocate(category, bytes);
+    char* block = (char*)malloc(headerSize + bytes);
+    if (block == nullptr)
+        return nullptr;
+    *(size_t*)block = bytes;
+    return block + headerSize;
+}
+
+void trackedFree(MemoryCategory category, void* data)
+{
+    if (data == nullptr)
+        return;
+    char* block = (char*)data - headerSize;
+    MemoryStats::deallocate(category, *(size_t*)block);
+    free(block);
+}
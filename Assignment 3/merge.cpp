@@ -0,0 +1,42 @@
+#include "framebuffer.h"
+
+/**
+ * Combines sharded renders (accumulation EXRs written with --shard/--samples)
+ * by adding their radiance sums and sample counts.
+ */
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        std::cerr << "Usage: ./merge <out_path> <shard.exr> [<shard.exr> ...]\n"
+                  << "A .exr <out_path> keeps the sums and counts so it can be merged again.\n";
+        return 1;
+    }
+
+    Framebuffer merged;
+    for (int i = 2; i < argc; i++) {
+        Framebuffer shard;
+        if (!shard.loadAccumulation(argv[i]))
+            return 1;
+
+        if (i == 2) {
+            merged.allocate(shard.resolution);
+        }
+        else if (shard.resolution != merged.resolution) {
+            std::cerr << argv[i] << " has a different resolution than " << argv[2] << std::endl;
+            return 1;
+        }
+        merged.addTile(shard, Vector2i(0, 0));
+    }
+
+    uint32_t minCount = *std::min_element(merged.sampleCount.begin(), merged.sampleCount.end());
+    uint32_t maxCount = *std::max_element(merged.sampleCount.begin(), merged.sampleCount.end());
+    std::cout << "Merged " << argc - 2 << " shards, " << minCount << "-" << maxCount << " samples per pixel" << std::endl;
+
+    std::string outPath = argv[1];
+    if (outPath.find(".png") > outPath.length())
+        return merged.saveAccumulation(outPath) ? 0 : 1;
+
+    merged.save(outPath);
+    return 0;
+}
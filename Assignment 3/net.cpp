@@ -0,0 +1,258 @@
+#include "net.h"
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+int listenSocket(std::string address, bool loopbackOnly) { std::cerr << "Sockets are not supported on this platform." << std::endl; return -1; }
+int acceptSocket(int listenFd) { return -1; }
+int connectSocket(std::string address) { std::cerr << "Sockets are not supported on this platform." << std::endl; return -1; }
+void closeSocket(int fd) {}
+void setReceiveTimeout(int fd, float seconds) {}
+bool sendAll(int fd, const void* data, size_t size) { return false; }
+bool recvAll(int fd, void* data, size_t size) { return false; }
+
+#else
+
+static bool isUnixAddress(const std::string& address)
+{
+    return address.compare(0, 5, "unix:") == 0;
+}
+
+static bool unixSocketAddress(const std::string& address, sockaddr_un& addr)
+{
+    std::string path = address.substr(5);
+    if (path.size() >= sizeof(addr.sun_path)) {
+        std::cerr << "Socket path too long: " << path << std::endl;
+        return false;
+    }
+
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    return true;
+}
+
+static addrinfo* resolveTcpAddress(const std::string& address, bool passive)
+{
+    size_t colon = address.rfind(':');
+    if (colon == std::string::npos) {
+        std::cerr << "Expected <host>:<port> or unix:<path>, got " << address << std::endl;
+        return nullptr;
+    }
+    std::string host = address.substr(0, colon), port = address.substr(colon + 1);
+
+    addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (passive) hints.ai_flags = AI_PASSIVE;
+
+    addrinfo* result = nullptr;
+    if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &result) != 0) {
+        std::cerr << "Could not resolve " << address << std::endl;
+        return nullptr;
+    }
+    return result;
+}
+
+static bool isLoopback(const sockaddr* addr)
+{
+    if (addr->sa_family == AF_INET)
+        return (ntohl(((const sockaddr_in*)addr)->sin_addr.s_addr) >> 24) == 127;
+    if (addr->sa_family == AF_INET6)
+        return IN6_IS_ADDR_LOOPBACK(&((const sockaddr_in6*)addr)->sin6_addr);
+    return false;
+}
+
+int listenSocket(std::string address, bool loopbackOnly)
+{
+    int fd = -1;
+
+    if (isUnixAddress(address)) {
+        sockaddr_un addr;
+        if (!unixSocketAddress(address, addr)) return -1;
+        unlink(addr.sun_path);
+
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+            std::cerr << "Could not bind " << address << ": " << std::strerror(errno) << std::endl;
+            closeSocket(fd);
+            return -1;
+        }
+    }
+    else {
+        std::string tcpAddress = loopbackOnly && address.compare(0, 1, ":") == 0 ? "127.0.0.1" + address : address;
+        addrinfo* info = resolveTcpAddress(tcpAddress, true);
+        if (info == nullptr) return -1;
+        if (loopbackOnly && !isLoopback(info->ai_addr)) {
+            std::cerr << "Only loopback addresses can be listened on, got " << address << std::endl;
+            freeaddrinfo(info);
+            return -1;
+        }
+
+        fd = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+        int reuse = 1;
+        if (fd >= 0) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        if (fd < 0 || bind(fd, info->ai_addr, info->ai_addrlen) != 0) {
+            std::cerr << "Could not bind " << address << ": " << std::strerror(errno) << std::endl;
+            closeSocket(fd);
+            fd = -1;
+        }
+        freeaddrinfo(info);
+        if (fd < 0) return -1;
+    }
+
+    if (listen(fd, 64) != 0) {
+        std::cerr << "Could not listen on " << address << std::endl;
+        closeSocket(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Sends to a closed peer fail with EPIPE instead of raising SIGPIPE
+#ifdef MSG_NOSIGNAL
+static const int sendFlags = MSG_NOSIGNAL;
+static void ignoreSigpipe(int) {}
+#else
+static const int sendFlags = 0;
+static void ignoreSigpipe(int fd)
+{
+#ifdef SO_NOSIGPIPE
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#else
+    (void)fd;
+    signal(SIGPIPE, SIG_IGN);
+#endif
+}
+#endif
+
+int acceptSocket(int listenFd)
+{
+    int fd = accept(listenFd, nullptr, nullptr);
+    if (fd >= 0) {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        ignoreSigpipe(fd);
+    }
+    return fd;
+}
+
+int connectSocket(std::string address)
+{
+    if (isUnixAddress(address)) {
+        sockaddr_un addr;
+        if (!unixSocketAddress(address, addr)) return -1;
+
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+            closeSocket(fd);
+            return -1;
+        }
+        ignoreSigpipe(fd);
+        return fd;
+    }
+
+    addrinfo* info = resolveTcpAddress(address, false);
+    if (info == nullptr) return -1;
+
+    int fd = -1;
+    for (addrinfo* a = info; a != nullptr; a = a->ai_next) {
+        fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd >= 0 && connect(fd, a->ai_addr, a->ai_addrlen) == 0) break;
+        closeSocket(fd);
+        fd = -1;
+    }
+    freeaddrinfo(info);
+
+    if (fd >= 0) {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        ignoreSigpipe(fd);
+    }
+    return fd;
+}
+
+void closeSocket(int fd)
+{
+    if (fd >= 0) close(fd);
+}
+
+void setReceiveTimeout(int fd, float seconds)
+{
+    timeval tv;
+    tv.tv_sec = (long)seconds;
+    tv.tv_usec = (long)((seconds - tv.tv_sec) * 1e6f);
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+}
+
+bool sendAll(int fd, const void* data, size_t size)
+{
+    const char* ptr = (const char*)data;
+    while (size > 0) {
+        ssize_t sent = send(fd, ptr, size, sendFlags);
+        if (sent <= 0) {
+            if (sent < 0 && errno == EINTR) continue;
+            return false;
+        }
+        ptr += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+bool recvAll(int fd, void* data, size_t size)
+{
+    char* ptr = (char*)data;
+    while (size > 0) {
+        ssize_t received = recv(fd, ptr, size, 0);
+        if (received <= 0) {
+            if (received < 0 && errno == EINTR) continue;
+            return false;
+        }
+        ptr += received;
+        size -= received;
+    }
+    return true;
+}
+
+#endif
+
+bool sendMessage(int fd, uint32_t type, const void* payload, size_t size)
+{
+    MessageHeader header;
+    header.type = type;
+    header.size = uint32_t(size);
+    return sendAll(fd, &header, sizeof(header)) && (size == 0 || sendAll(fd, payload, size));
+}
+
+bool sendMessage(int fd, uint32_t type, const std::string& payload)
+{
+    return sendMessage(fd, type, payload.data(), payload.size());
+}
+
+bool recvMessage(int fd, uint32_t& type, std::vector<char>& payload)
+{
+    MessageHeader header;
+    if (!recvAll(fd, &header, sizeof(header))) return false;
+
+    type = header.type;
+    payload.resize(header.size);
+    return header.size == 0 || recvAll(fd, payload.data(), header.size);
+}
@@ -0,0 +1,534 @@
+#include "obj.h"
+#include "parallel.h"
+#include "trace.h"
+
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "tinyobjloader/tiny_obj_loader.h"
+
+ObjParser objParser = OBJ_PARSER_FAST;
+
+static std::string directoryOf(std::string path)
+{
+    size_t slash = path.find_last_of("/\\");
+    return slash == std::string::npos ? std::string() : path.substr(0, slash);
+}
+
+void loadObj(std::string pathToObj, ObjFile& obj)
+{
+    if (objParser == OBJ_PARSER_FAST && loadObjFast(pathToObj, obj))
+        return;
+    obj = ObjFile();
+    loadObjTinyobj(pathToObj, obj);
+}
+
+void loadObjTinyobj(std::string pathToObj, ObjFile& obj)
+{
+    tinyobj::ObjReader reader;
+    tinyobj::ObjReaderConfig reader_config;
+    if (!reader.ParseFromFile(pathToObj, reader_config))
+        throw std::runtime_error("TinyObjReader: " + reader.Error());
+
+    if (!reader.Warning().empty()) {
+        std::cout << "TinyObjReader: " << reader.Warning();
+    }
+
+    obj.attrib = reader.GetAttrib();
+    obj.shapes = reader.GetShapes();
+    obj.materials = reader.GetMaterials();
+
+    // Material libraries are not reported by the reader
+    std::ifstream objStream(pathToObj.c_str());
+    std::string line;
+    while (std::getline(objStream, line)) {
+        if (line.compare(0, 7, "mtllib ") != 0)
+            continue;
+        std::istringstream names(line.substr(7));
+        std::string name;
+        while (names >> name)
+            obj.materialLibraries.push_back(name);
+    }
+}
+
+#ifndef _WIN32
+
+static inline bool isDigit(char c) { return c >= '0' && c <= '9'; }
+static inline bool isBlank(char c) { return c == ' ' || c == '\t'; }
+static inline bool isLineEnd(char c) { return c == '\n' || c == '\r'; }
+static inline bool isTokenEnd(const char* p, const char* end) { return p == end || isBlank(*p) || isLineEnd(*p); }
+
+static inline void skipBlanks(const char*& p, const char* end)
+{
+    while (p < end && isBlank(*p))
+        p++;
+}
+
+/**
+ * Reads [+-]digits[.digits][(e|E)[+-]digits]. The value is computed with the
+ * same double arithmetic as tinyobjloader's tryParseDouble, so both parsers
+ * give bit identical floats. A missing number is 0 like in tinyobjloader,
+ * any other format is rejected.
+ */
+static inline bool parseReal(const char*& p, const char* end, float& value)
+{
+    skipBlanks(p, end);
+    if (p == end || isLineEnd(*p)) {
+        value = 0.f;
+        return true;
+    }
+
+    bool negative = false;
+    if (*p == '+' || *p == '-') {
+        negative = *p == '-';
+        p++;
+    }
+
+    double mantissa = 0.0;
+    int read = 0;
+    while (p < end && isDigit(*p)) {
+        mantissa *= 10;
+        mantissa += int(*p - '0');
+        p++;
+        read++;
+    }
+    if (read == 0)
+        return false;
+
+    if (p < end && *p == '.') {
+        static const double powLut[] = { 1.0, 0.1, 0.01, 0.001, 0.0001, 0.00001, 0.000001, 0.0000001 };
+        p++;
+        read = 1;
+        while (p < end && isDigit(*p)) {
+            mantissa += int(*p - '0') * (read < 8 ? powLut[read] : std::pow(10.0, -read));
+            read++;
+            p++;
+        }
+    }
+
+    int exponent = 0;
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        bool negativeExponent = false;
+        if (p < end && (*p == '+' || *p == '-')) {
+            negativeExponent = *p == '-';
+            p++;
+        }
+        read = 0;
+        while (p < end && isDigit(*p)) {
+            if (exponent > 2147483647 / 10)
+                return false;
+            exponent = exponent * 10 + int(*p - '0');
+            p++;
+            read++;
+        }
+        if (read == 0)
+            return false;
+        if (negativeExponent)
+            exponent = -exponent;
+    }
+
+    if (!isTokenEnd(p, end))
+        return false;
+    value = float((negative ? -1 : 1) * (exponent ? std::ldexp(mantissa * std::pow(5.0, exponent), exponent) : mantissa));
+    return true;
+}
+
+static inline bool parseIndex(const char*& p, const char* end, int& value)
+{
+    bool negative = false;
+    if (p < end && (*p == '+' || *p == '-')) {
+        negative = *p == '-';
+        p++;
+    }
+    int digits = 0;
+    value = 0;
+    while (p < end && isDigit(*p)) {
+        if (++digits > 9)
+            return false;
+        value = value * 10 + int(*p - '0');
+        p++;
+    }
+    if (negative)
+        value = -value;
+    return digits > 0 && value != 0;
+}
+
+static inline std::string parseName(const char*& p, const char* end)
+{
+    skipBlanks(p, end);
+    const char* begin = p;
+    while (!isTokenEnd(p, end))
+        p++;
+    return std::string(begin, p);
+}
+
+// A line that affects shapes or materials, at the chunk's face count
+struct ObjEvent {
+    enum Type { SHAPE, MATERIAL, LIBRARY } type;
+    size_t face;
+    std::vector<std::string> names;
+    int materialId = -1;
+
+    ObjEvent(Type type, size_t face) : type(type), face(face) {}
+};
+
+struct ObjChunk {
+    const char* begin;
+    const char* end;
+
+    std::vector<float> vertices, normals, texcoords;
+    // 3 per face. Relative indices hold the chunk's own count plus the index
+    // until the counts of the chunks before are known.
+    std::vector<tinyobj::index_t> indices;
+    // Entry of indices and a mask of its relative components (1 vertex, 2 normal, 4 texcoord)
+    std::vector<std::pair<size_t, int>> relative;
+    std::vector<ObjEvent> events;
+
+    size_t numFaces() { return this->indices.size() / 3; }
+};
+
+// Counts the v, vn, vt and f lines of [begin, end) that start without blanks
+static void countLines(const char* begin, const char* end, size_t counts[4])
+{
+    counts[0] = counts[1] = counts[2] = counts[3] = 0;
+    for (const char* line = begin; line < end; line++) {
+        if (end - line >= 2) {
+            if (line[0] == 'v') {
+                if (isBlank(line[1]))
+                    counts[0]++;
+                else if (end - line >= 3 && isBlank(line[2]) && line[1] == 'n')
+                    counts[1]++;
+                else if (end - line >= 3 && isBlank(line[2]) && line[1] == 't')
+                    counts[2]++;
+            }
+            else if (line[0] == 'f' && isBlank(line[1])) {
+                counts[3]++;
+            }
+        }
+        line = (const char*)std::memchr(line, '\n', end - line);
+        if (line == nullptr)
+            break;
+    }
+}
+
+static bool parseChunk(ObjChunk& chunk)
+{
+    // Sized from a scan of the line keywords, so that nothing has to regrow
+    size_t counts[4];
+    countLines(chunk.begin, chunk.end, counts);
+    chunk.vertices.reserve(3 * counts[0]);
+    chunk.normals.reserve(3 * counts[1]);
+    chunk.texcoords.reserve(2 * counts[2]);
+    chunk.indices.reserve(3 * counts[3]);
+
+    const char* p = chunk.begin;
+    const char* end = chunk.end;
+    while (p < end) {
+        skipBlanks(p, end);
+        const char* line = p;
+        // Keywords have to be followed by a blank, as in tinyobjloader
+        auto keyword = [&](const char* word, size_t length) {
+            if (size_t(end - line) <= length || std::char_traits<char>::compare(line, word, length) != 0 || !isBlank(line[length]))
+                return false;
+            p = line + length;
+            return true;
+        };
+
+        if (keyword("v", 1)) {
+            float v[3];
+            for (int i = 0; i < 3; i++) {
+                if (!parseReal(p, end, v[i]))
+                    return false;
+            }
+            chunk.vertices.insert(chunk.vertices.end(), v, v + 3);
+        }
+        else if (keyword("vn", 2)) {
+            float n[3];
+            for (int i = 0; i < 3; i++) {
+                if (!parseReal(p, end, n[i]))
+                    return false;
+            }
+            chunk.normals.insert(chunk.normals.end(), n, n + 3);
+        }
+        else if (keyword("vt", 2)) {
+            float t[2];
+            for (int i = 0; i < 2; i++) {
+                if (!parseReal(p, end, t[i]))
+                    return false;
+            }
+            chunk.texcoords.insert(chunk.texcoords.end(), t, t + 2);
+        }
+        else if (keyword("f", 1)) {
+            int numVertices = 0;
+            int counts[3] = { int(chunk.vertices.size() / 3), int(chunk.normals.size() / 3), int(chunk.texcoords.size() / 2) };
+            while (true) {
+                skipBlanks(p, end);
+                if (p == end || isLineEnd(*p))
+                    break;
+                // Only triangles, tinyobjloader triangulates polygons
+                if (++numVertices > 3)
+                    return false;
+
+                // v, v/vt, v//vn or v/vt/vn
+                int raw[3] = { 0, 0, 0 };
+                if (!parseIndex(p, end, raw[0]))
+                    return false;
+                if (p < end && *p == '/') {
+                    p++;
+                    if (p < end && *p == '/') {
+                        p++;
+                        if (!parseIndex(p, end, raw[1]))
+                            return false;
+                    }
+                    else {
+                        if (!parseIndex(p, end, raw[2]))
+                            return false;
+                        if (p < end && *p == '/') {
+                            p++;
+                            if (!parseIndex(p, end, raw[1]))
+                                return false;
+                        }
+                    }
+                }
+                if (!isTokenEnd(p, end))
+                    return false;
+
+                int resolved[3] = { -1, -1, -1 };
+                int mask = 0;
+                for (int c = 0; c < 3; c++) {
+                    if (raw[c] > 0)
+                        resolved[c] = raw[c] - 1;
+                    else if (raw[c] < 0) {
+                        resolved[c] = counts[c] + raw[c];
+                        mask |= 1 << c;
+                    }
+                }
+                tinyobj::index_t index;
+                index.vertex_index = resolved[0];
+                index.normal_index = resolved[1];
+                index.texcoord_index = resolved[2];
+                if (mask != 0)
+                    chunk.relative.push_back(std::make_pair(chunk.indices.size(), mask));
+                chunk.indices.push_back(index);
+            }
+            if (numVertices != 3)
+                return false;
+        }
+        else if (keyword("o", 1) || keyword("g", 1)) {
+            ObjEvent event(ObjEvent::SHAPE, chunk.numFaces());
+            event.names.push_back(parseName(p, end));
+            chunk.events.push_back(event);
+        }
+        else if (keyword("usemtl", 6)) {
+            ObjEvent event(ObjEvent::MATERIAL, chunk.numFaces());
+            event.names.push_back(parseName(p, end));
+            chunk.events.push_back(event);
+        }
+        else if (keyword("mtllib", 6)) {
+            ObjEvent event(ObjEvent::LIBRARY, chunk.numFaces());
+            for (std::string name = parseName(p, end); !name.empty(); name = parseName(p, end)) {
+                // tinyobjloader treats backslashes as escapes
+                if (name.find('\\') != std::string::npos)
+                    return false;
+                event.names.push_back(name);
+            }
+            chunk.events.push_back(event);
+        }
+        else if (keyword("l", 1) || keyword("p", 1)) {
+            return false;
+        }
+
+        // Comments, smoothing groups and anything unknown are skipped
+        while (p < end && !isLineEnd(*p))
+            p++;
+        while (p < end && isLineEnd(*p))
+            p++;
+    }
+    return true;
+}
+
+bool loadObjFast(std::string pathToObj, ObjFile& obj)
+{
+    TRACE_SCOPE("Parse OBJ (fast)", pathToObj);
+    int fd = open(pathToObj.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        close(fd);
+        return false;
+    }
+    size_t size = size_t(info.st_size);
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+        return false;
+    madvise(mapping, size, MADV_SEQUENTIAL);
+    const char* data = (const char*)mapping;
+
+    // Chunks of at least 1 MB, a few per thread to balance uneven content
+    size_t numChunks = std::max<size_t>(1, std::min<size_t>(size >> 20, 4 * getNumThreads()));
+    std::vector<ObjChunk> chunks(numChunks);
+    const char* begin = data;
+    for (size_t c = 0; c < numChunks; c++) {
+        const char* end = data + size * (c + 1) / numChunks;
+        while (end > data && end < data + size && end[-1] != '\n')
+            end++;
+        chunks[c].begin = begin;
+        chunks[c].end = std::max(begin, end);
+        begin = chunks[c].end;
+    }
+
+    std::atomic<bool> supported(true);
+    parallelFor(0, int(numChunks), 1, [&](int first, int last) {
+        for (int c = first; c < last; c++) {
+            if (supported && !parseChunk(chunks[c]))
+                supported = false;
+        }
+    });
+    munmap(mapping, size);
+    if (!supported)
+        return false;
+
+    // Offsets of every chunk, then materials and shape boundaries in file order
+    std::vector<size_t> vertexOffsets(numChunks + 1, 0), normalOffsets(numChunks + 1, 0), texcoordOffsets(numChunks + 1, 0);
+    std::vector<size_t> faceOffsets(numChunks + 1, 0);
+    std::vector<int> chunkMaterials(numChunks, -1);
+    std::vector<std::pair<size_t, std::string>> boundaries;
+    std::map<std::string, int> materialMap;
+    std::set<std::string> loadedLibraries;
+    std::string directory = directoryOf(pathToObj);
+    int material = -1;
+    for (size_t c = 0; c < numChunks; c++) {
+        ObjChunk& chunk = chunks[c];
+        vertexOffsets[c + 1] = vertexOffsets[c] + chunk.vertices.size();
+        normalOffsets[c + 1] = normalOffsets[c] + chunk.normals.size();
+        texcoordOffsets[c + 1] = texcoordOffsets[c] + chunk.texcoords.size();
+        faceOffsets[c + 1] = faceOffsets[c] + chunk.numFaces();
+        chunkMaterials[c] = material;
+
+        for (ObjEvent& event : chunk.events) {
+            if (event.type == ObjEvent::SHAPE) {
+                size_t face = faceOffsets[c] + event.face;
+                // The last of several names before the same face wins
+                if (!boundaries.empty() && boundaries.back().first == face)
+                    boundaries.back().second = event.names[0];
+                else
+                    boundaries.push_back(std::make_pair(face, event.names[0]));
+            }
+            else if (event.type == ObjEvent::MATERIAL) {
+                auto found = materialMap.find(event.names[0]);
+                material = found == materialMap.end() ? -1 : found->second;
+                event.materialId = material;
+            }
+            else {
+                // Like tinyobjloader, the first library of the line that opens is loaded
+                for (std::string& name : event.names) {
+                    obj.materialLibraries.push_back(name);
+                }
+                for (std::string& name : event.names) {
+                    if (loadedLibraries.count(name))
+                        continue;
+                    std::ifstream stream((directory.empty() ? name : directory + "/" + name).c_str());
+                    if (!stream)
+                        continue;
+                    std::string warning, error;
+                    tinyobj::LoadMtl(&materialMap, &obj.materials, &stream, &warning, &error);
+                    loadedLibraries.insert(name);
+                    break;
+                }
+            }
+        }
+    }
+
+    // Concatenate the chunks, resolving relative indices
+    size_t numFaces = faceOffsets[numChunks];
+    size_t numVertices = vertexOffsets[numChunks] / 3, numNormals = normalOffsets[numChunks] / 3, numTexcoords = texcoordOffsets[numChunks] / 2;
+    obj.attrib.vertices.resize(vertexOffsets[numChunks]);
+    obj.attrib.normals.resize(normalOffsets[numChunks]);
+    obj.attrib.texcoords.resize(texcoordOffsets[numChunks]);
+    std::vector<tinyobj::index_t> indices(3 * numFaces);
+    std::vector<int> materialIds(numFaces);
+
+    parallelFor(0, int(numChunks), 1, [&](int first, int last) {
+        for (int c = first; c < last; c++) {
+            ObjChunk& chunk = chunks[c];
+            std::copy(chunk.vertices.begin(), chunk.vertices.end(), obj.attrib.vertices.begin() + vertexOffsets[c]);
+            std::copy(chunk.normals.begin(), chunk.normals.end(), obj.attrib.normals.begin() + normalOffsets[c]);
+            std::copy(chunk.texcoords.begin(), chunk.texcoords.end(), obj.attrib.texcoords.begin() + texcoordOffsets[c]);
+
+            for (auto& entry : chunk.relative) {
+                tinyobj::index_t& index = chunk.indices[entry.first];
+                if (entry.second & 1) index.vertex_index += int(vertexOffsets[c] / 3);
+                if (entry.second & 2) index.normal_index += int(normalOffsets[c] / 3);
+                if (entry.second & 4) index.texcoord_index += int(texcoordOffsets[c] / 2);
+            }
+            for (auto& index : chunk.indices) {
+                if (index.vertex_index < 0 || size_t(index.vertex_index) >= numVertices
+                    || index.normal_index < -1 || (index.normal_index >= 0 && size_t(index.normal_index) >= numNormals)
+                    || index.texcoord_index < -1 || (index.texcoord_index >= 0 && size_t(index.texcoord_index) >= numTexcoords))
+                    supported = false;
+            }
+            std::copy(chunk.indices.begin(), chunk.indices.end(), indices.begin() + 3 * faceOffsets[c]);
+
+            int current = chunkMaterials[c];
+            size_t face = 0;
+            for (ObjEvent& event : chunk.events) {
+                if (event.type != ObjEvent::MATERIAL)
+                    continue;
+                std::fill(materialIds.begin() + faceOffsets[c] + face, materialIds.begin() + faceOffsets[c] + event.face, current);
+                face = event.face;
+                current = event.materialId;
+            }
+            std::fill(materialIds.begin() + faceOffsets[c] + face, materialIds.begin() + faceOffsets[c + 1], current);
+
+            chunk = ObjChunk();
+        }
+    });
+    if (!supported)
+        return false;
+
+    // Shapes are the non-empty face ranges between o and g lines
+    boundaries.push_back(std::make_pair(numFaces, std::string()));
+    size_t shapeBegin = 0;
+    std::string shapeName;
+    for (auto& boundary : boundaries) {
+        if (boundary.first > shapeBegin) {
+            obj.shapes.emplace_back();
+            tinyobj::shape_t& shape = obj.shapes.back();
+            shape.name = shapeName;
+            shape.mesh.indices.assign(indices.begin() + 3 * shapeBegin, indices.begin() + 3 * boundary.first);
+            shape.mesh.num_face_vertices.assign(boundary.first - shapeBegin, 3);
+            shape.mesh.material_ids.assign(materialIds.begin() + shapeBegin, materialIds.begin() + boundary.first);
+        }
+        shapeBegin = boundary.first;
+        shapeName = boundary.second;
+    }
+    return true;
+}
+
+#else
+
+bool loadObjFast(std::string pathToObj, ObjFile& obj)
+{
+    // No mmap, always tinyobjloader
+    return false;
+}
+
+#endif
@@ -0,0 +1,126 @@
+#include "parallel.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+static int numThreads = 0;
+
+// Set on threads running a parallelFor body, nested loops then run inline
+static thread_local bool insideParallelFor = false;
+
+int getNumThreads()
+{
+    if (numThreads <= 0)
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+    return numThreads;
+}
+
+void setNumThreads(int n)
+{
+    numThreads = n;
+}
+
+void parallelFor(int start, int stop, int chunkSize, const std::function<void(int, int)>& func)
+{
+    if (stop <= start) return;
+    chunkSize = std::max(chunkSize, 1);
+
+    if (insideParallelFor) {
+        func(start, stop);
+        return;
+    }
+
+    int numChunks = (stop - start + chunkSize - 1) / chunkSize;
+    int nThreads = std::min(getNumThreads(), numChunks);
+
+    std::atomic<int> nextChunk(0);
+    auto worker = [&]() {
+        insideParallelFor = true;
+        for (int c = nextChunk++; c < numChunks; c = nextChunk++) {
+            int begin = start + c * chunkSize;
+            TRACE_SCOPE("Chunk");
+            func(begin, std::min(begin + chunkSize, stop));
+        }
+        insideParallelFor = false;
+    };
+
+    // The calling thread works too
+    std::vector<std::thread> threads;
+    for (int i = 1; i < nThreads; i++) {
+        threads.emplace_back([&, i]() {
+            setTraceThread(i, "worker " + std::to_string(i));
+            worker();
+        });
+    }
+    worker();
+
+    for (auto& t : threads)
+        t.join();
+}
+
+void TaskGroup::run(std::function<void()> task)
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->queue.push_back(std::move(task));
+    this->pending++;
+    this->changed.notify_one();
+}
+
+void TaskGroup::work()
+{
+    bool nested = insideParallelFor;
+    insideParallelFor = true;
+
+    std::unique_lock<std::mutex> lock(this->mutex);
+    while (this->pending > 0) {
+        if (this->queue.empty()) {
+            // Running tasks may still add more
+            this->changed.wait(lock);
+            continue;
+        }
+        std::function<void()> task = std::move(this->queue.front());
+        this->queue.pop_front();
+        lock.unlock();
+        std::exception_ptr error;
+        try {
+            TRACE_SCOPE("Task");
+            task();
+        }
+        catch (...) {
+            error = std::current_exception();
+        }
+        lock.lock();
+        if (error && !this->error)
+            this->error = error;
+        if (--this->pending == 0)
+            this->changed.notify_all();
+    }
+
+    insideParallelFor = nested;
+}
+
+void TaskGroup::wait()
+{
+    std::vector<std::thread> threads;
+    if (!insideParallelFor) {
+        for (int i = 1; i < getNumThreads(); i++) {
+            threads.emplace_back([&, i]() {
+                setTraceThread(i, "worker " + std::to_string(i));
+                this->work();
+            });
+        }
+    }
+    this->work();
+
+    for (auto& t : threads)
+        t.join();
+
+    if (this->error) {
+        std::exception_ptr error = this->error;
+        this->error = nullptr;
+        std::rethrow_exception(error);
+    }
+}
@@ -0,0 +1,150 @@
+#include "perf.h"
+
+#include <cstring>
+
+#ifdef __linux__
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+static const char* eventNames[NUM_PERF_EVENTS] = {
+    "cycles", "instructions", "l1dMisses", "llcMisses", "branchMisses", "dtlbMisses"
+};
+
+PerfCounters::PerfCounters()
+{
+    for (int e = 0; e < NUM_PERF_EVENTS; e++)
+        this->fds[e] = -1;
+    std::memset(this->baseline, 0, sizeof(this->baseline));
+}
+
+PerfCounters::~PerfCounters()
+{
+#ifdef __linux__
+    for (int e = 0; e < NUM_PERF_EVENTS; e++) {
+        if (this->fds[e] >= 0)
+            close(this->fds[e]);
+    }
+#endif
+}
+
+bool PerfCounters::open()
+{
+#ifdef __linux__
+    auto cacheEvent = [](uint64_t cache, uint64_t result) {
+        return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (result << 16);
+    };
+    struct { uint32_t type; uint64_t config; } events[NUM_PERF_EVENTS] = {
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        { PERF_TYPE_HW_CACHE, cacheEvent(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_RESULT_MISS) },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+        { PERF_TYPE_HW_CACHE, cacheEvent(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_RESULT_MISS) }
+    };
+
+    int lastErrno = 0;
+    for (int e = 0; e < NUM_PERF_EVENTS; e++) {
+        struct perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = events[e].type;
+        attr.config = events[e].config;
+        // Inherited counters cannot be read as a group, so every event gets
+        // its own counter and is scaled by its own enabled and running times
+        attr.inherit = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        this->fds[e] = int(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+        if (this->fds[e] < 0)
+            lastErrno = errno;
+    }
+
+    if (!this->available()) {
+        this->error = std::string("perf_event_open failed: ") + strerror(lastErrno);
+        if (lastErrno == EACCES || lastErrno == EPERM)
+            this->error += " (check /proc/sys/kernel/perf_event_paranoid or the container's seccomp profile)";
+        return false;
+    }
+    return true;
+#else
+    this->error = "hardware counters are only supported on Linux";
+    return false;
+#endif
+}
+
+bool PerfCounters::available()
+{
+    for (int e = 0; e < NUM_PERF_EVENTS; e++) {
+        if (this->fds[e] >= 0)
+            return true;
+    }
+    return false;
+}
+
+bool PerfCounters::read(int event, uint64_t result[3])
+{
+#ifdef __linux__
+    return this->fds[event] >= 0 && ::read(this->fds[event], result, 3 * sizeof(uint64_t)) == 3 * sizeof(uint64_t);
+#else
+    return false;
+#endif
+}
+
+// A phase is the difference of two reads. Resetting the counters would not
+// clear the counts that exited threads passed on to the parent.
+void PerfCounters::start()
+{
+    for (int e = 0; e < NUM_PERF_EVENTS; e++) {
+        if (!this->read(e, this->baseline[e]))
+            std::memset(this->baseline[e], 0, sizeof(this->baseline[e]));
+    }
+}
+
+PerfCounters::Phase PerfCounters::stop()
+{
+    Phase phase;
+    for (int e = 0; e < NUM_PERF_EVENTS; e++) {
+        uint64_t now[3];
+        if (!this->read(e, now))
+            continue;
+
+        uint64_t count = now[0] - this->baseline[e][0];
+        uint64_t enabled = now[1] - this->baseline[e][1];
+        uint64_t running = now[2] - this->baseline[e][2];
+        // Never scheduled on the hardware, e.g. too many events for the PMU
+        if (running == 0)
+            continue;
+        phase.values[e] = enabled > running ? uint64_t(double(count) * enabled / running) : count;
+        phase.valid[e] = true;
+    }
+    return phase;
+}
+
+nlohmann::json PerfCounters::toJson(const Phase& phase, std::vector<std::pair<std::string, double>> perUnit)
+{
+    nlohmann::json out;
+    for (auto& unit : perUnit) {
+        if (unit.second > 0.0)
+            out[unit.first] = nlohmann::json::object();
+    }
+    for (int e = 0; e < NUM_PERF_EVENTS; e++) {
+        if (!phase.valid[e]) {
+            out[eventNames[e]] = nullptr;
+            continue;
+        }
+        out[eventNames[e]] = phase.values[e];
+        for (auto& unit : perUnit) {
+            if (unit.second > 0.0)
+                out[unit.first][eventNames[e]] = phase.values[e] / unit.second;
+        }
+    }
+    if (phase.valid[PERF_CYCLES] && phase.valid[PERF_INSTRUCTIONS] && phase.values[PERF_CYCLES] > 0)
+        out["ipc"] = double(phase.values[PERF_INSTRUCTIONS]) / phase.values[PERF_CYCLES];
+    return out;
+}
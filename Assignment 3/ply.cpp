@@ -0,0 +1,577 @@
+#include "ply.h"
+#include "trace.h"
+
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+enum PlyFormat {
+    PLY_ASCII = 0,
+    PLY_BINARY_LITTLE_ENDIAN,
+    PLY_BINARY_BIG_ENDIAN
+};
+
+enum PlyType {
+    PLY_INT8 = 0,
+    PLY_UINT8,
+    PLY_INT16,
+    PLY_UINT16,
+    PLY_INT32,
+    PLY_UINT32,
+    PLY_FLOAT32,
+    PLY_FLOAT64,
+    PLY_INVALID
+};
+
+static const size_t plyTypeSizes[] = { 1, 1, 2, 2, 4, 4, 4, 8 };
+
+static PlyType plyType(const std::string& name)
+{
+    if (name == "char" || name == "int8") return PLY_INT8;
+    if (name == "uchar" || name == "uint8") return PLY_UINT8;
+    if (name == "short" || name == "int16") return PLY_INT16;
+    if (name == "ushort" || name == "uint16") return PLY_UINT16;
+    if (name == "int" || name == "int32") return PLY_INT32;
+    if (name == "uint" || name == "uint32") return PLY_UINT32;
+    if (name == "float" || name == "float32") return PLY_FLOAT32;
+    if (name == "double" || name == "float64") return PLY_FLOAT64;
+    return PLY_INVALID;
+}
+
+struct PlyProperty {
+    std::string name;
+    PlyType type = PLY_INVALID;
+    // Lists are a count of countType followed by that many values of type
+    bool isList = false;
+    PlyType countType = PLY_INVALID;
+    // Byte offset in a binary record, for elements without lists
+    size_t offset = 0;
+};
+
+struct PlyElement {
+    std::string name;
+    size_t count = 0;
+    std::vector<PlyProperty> properties;
+    // Bytes per binary record, 0 if the element has lists
+    size_t stride = 0;
+
+    // Index of the first property with one of the names, -1 if there is none
+    int find(std::initializer_list<const char*> names) const
+    {
+        for (const char* name : names) {
+            for (size_t i = 0; i < this->properties.size(); i++) {
+                if (this->properties[i].name == name)
+                    return int(i);
+            }
+        }
+        return -1;
+    }
+};
+
+// The bytes of a file, memory mapped where possible
+struct PlyFile {
+    const char* data = nullptr;
+    size_t size = 0;
+    void* mapping = nullptr;
+    std::vector<char> buffer;
+
+    bool open(std::string path)
+    {
+#ifndef _WIN32
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size == 0) {
+            close(fd);
+            return false;
+        }
+        this->size = size_t(info.st_size);
+        this->mapping = mmap(nullptr, this->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (this->mapping != MAP_FAILED) {
+            // Faces index vertices anywhere in the file
+            madvise(this->mapping, this->size, MADV_WILLNEED);
+            this->data = (const char*)this->mapping;
+            return true;
+        }
+        this->mapping = nullptr;
+#endif
+        std::ifstream file(path.c_str(), std::ios::binary);
+        if (!file)
+            return false;
+        this->buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        this->data = this->buffer.data();
+        this->size = this->buffer.size();
+        return this->size > 0;
+    }
+
+    ~PlyFile()
+    {
+#ifndef _WIN32
+        if (this->mapping != nullptr)
+            munmap(this->mapping, this->size);
+#endif
+    }
+};
+
+static bool hostIsLittleEndian()
+{
+    uint16_t one = 1;
+    uint8_t first;
+    memcpy(&first, &one, 1);
+    return first == 1;
+}
+
+static inline double readBinary(const char* p, PlyType type, bool swap)
+{
+    char bytes[8];
+    size_t size = plyTypeSizes[type];
+    if (swap) {
+        for (size_t i = 0; i < size; i++)
+            bytes[i] = p[size - 1 - i];
+    }
+    else {
+        memcpy(bytes, p, size);
+    }
+
+    switch (type) {
+    case PLY_INT8: { int8_t v; memcpy(&v, bytes, 1); return v; }
+    case PLY_UINT8: { uint8_t v; memcpy(&v, bytes, 1); return v; }
+    case PLY_INT16: { int16_t v; memcpy(&v, bytes, 2); return v; }
+    case PLY_UINT16: { uint16_t v; memcpy(&v, bytes, 2); return v; }
+    case PLY_INT32: { int32_t v; memcpy(&v, bytes, 4); return v; }
+    case PLY_UINT32: { uint32_t v; memcpy(&v, bytes, 4); return v; }
+    case PLY_FLOAT32: { float v; memcpy(&v, bytes, 4); return v; }
+    case PLY_FLOAT64: { double v; memcpy(&v, bytes, 8); return v; }
+    default: return 0.0;
+    }
+}
+
+// Whitespace separated numbers of an ascii body
+struct PlyTokens {
+    const char* p;
+    const char* end;
+
+    bool next(double& value)
+    {
+        while (this->p < this->end && std::isspace((unsigned char)*this->p))
+            this->p++;
+        char token[64];
+        size_t length = 0;
+        while (this->p < this->end && !std::isspace((unsigned char)*this->p)) {
+            if (length + 1 >= sizeof(token))
+                return false;
+            token[length++] = *this->p++;
+        }
+        if (length == 0)
+            return false;
+        token[length] = '\0';
+        char* parsed;
+        value = strtod(token, &parsed);
+        return parsed == token + length;
+    }
+};
+
+/**
+ * Vertex records, either in place in a binary file or converted to floats
+ * from an ascii one. Properties are the indices of position, normal and
+ * texture coordinate components, -1 where missing.
+ */
+struct PlyVertices {
+    const char* data = nullptr;
+    size_t count = 0;
+    bool swap = false;
+    PlyElement element;
+    int position[3], normal[3], uv[2];
+
+    bool hasNormals() const { return this->normal[0] >= 0 && this->normal[1] >= 0 && this->normal[2] >= 0; }
+    bool hasUvs() const { return this->uv[0] >= 0 && this->uv[1] >= 0; }
+
+    inline float get(size_t vertex, int property) const
+    {
+        const PlyProperty& prop = this->element.properties[property];
+        const char* p = this->data + vertex * this->element.stride + prop.offset;
+        if (prop.type == PLY_FLOAT32 && !this->swap) {
+            float value;
+            memcpy(&value, p, sizeof(float));
+            return value;
+        }
+        return float(readBinary(p, prop.type, this->swap));
+    }
+
+    inline Vector3f get3(size_t vertex, const int* properties) const
+    {
+        return Vector3f(this->get(vertex, properties[0]), this->get(vertex, properties[1]), this->get(vertex, properties[2]));
+    }
+};
+
+// Copies the vertex attributes into the surface's vertex buffers
+static void addVertices(Surface& surf, const PlyVertices& vertices)
+{
+    bool hasNormals = vertices.hasNormals(), hasUvs = vertices.hasUvs();
+    surf.vertices.reserve(surf.vertices.size() + vertices.count);
+    if (hasNormals)
+        surf.normals.reserve(surf.normals.size() + vertices.count);
+    if (hasUvs)
+        surf.uvs.reserve(surf.uvs.size() + vertices.count);
+    for (size_t i = 0; i < vertices.count; i++) {
+        surf.vertices.push_back(vertices.get3(i, vertices.position));
+        if (hasNormals)
+            surf.normals.push_back(vertices.get3(i, vertices.normal));
+        if (hasUvs)
+            surf.uvs.push_back(Vector2f(vertices.get(i, vertices.uv[0]), vertices.get(i, vertices.uv[1])));
+    }
+}
+
+// Adds a polygon as a fan of triangles, indices have been checked by the caller
+static void addFace(Surface& surf, int firstVertex, const uint32_t* face, size_t numCorners)
+{
+    for (size_t k = 1; k + 1 < numCorners; k++)
+        surf.addTriangle(Vector3i(firstVertex + int(face[0]), firstVertex + int(face[k]), firstVertex + int(face[k + 1])));
+}
+
+static bool parseHeader(const char*& p, const char* end, PlyFormat& format, std::vector<PlyElement>& elements, std::string& error)
+{
+    bool first = true, hasFormat = false;
+    while (p < end) {
+        const char* lineEnd = (const char*)memchr(p, '\n', end - p);
+        if (lineEnd == nullptr)
+            break;
+        std::istringstream line(std::string(p, lineEnd));
+        p = lineEnd + 1;
+
+        std::string keyword;
+        line >> keyword;
+        if (first) {
+            if (keyword != "ply") {
+                error = "not a PLY file";
+                return false;
+            }
+            first = false;
+        }
+        else if (keyword == "format") {
+            std::string name;
+            line >> name;
+            if (name == "ascii")
+                format = PLY_ASCII;
+            else if (name == "binary_little_endian")
+                format = PLY_BINARY_LITTLE_ENDIAN;
+            else if (name == "binary_big_endian")
+                format = PLY_BINARY_BIG_ENDIAN;
+            else {
+                error = "unknown format " + name;
+                return false;
+            }
+            hasFormat = true;
+        }
+        else if (keyword == "element") {
+            PlyElement element;
+            if (!(line >> element.name >> element.count)) {
+                error = "invalid element line";
+                return false;
+            }
+            elements.push_back(element);
+        }
+        else if (keyword == "property") {
+            if (elements.empty()) {
+                error = "property outside of an element";
+                return false;
+            }
+            PlyProperty property;
+            std::string type;
+            line >> type;
+            if (type == "list") {
+                std::string countType;
+                line >> countType >> type;
+                property.isList = true;
+                property.countType = plyType(countType);
+                if (property.countType == PLY_INVALID || property.countType >= PLY_FLOAT32) {
+                    error = "invalid list count type " + countType;
+                    return false;
+                }
+            }
+            property.type = plyType(type);
+            if (property.type == PLY_INVALID || !(line >> property.name)) {
+                error = "invalid property type " + type;
+                return false;
+            }
+            elements.back().properties.push_back(property);
+        }
+        else if (keyword == "end_header") {
+            if (!hasFormat) {
+                error = "missing format";
+                return false;
+            }
+            // Record layouts of the binary formats
+            for (auto& element : elements) {
+                size_t offset = 0;
+                bool hasList = false;
+                for (auto& property : element.properties) {
+                    property.offset = offset;
+                    offset += plyTypeSizes[property.type];
+                    hasList = hasList || property.isList;
+                }
+                element.stride = hasList ? 0 : offset;
+            }
+            return true;
+        }
+        // comment, obj_info and empty lines are skipped
+    }
+    error = "missing end_header";
+    return false;
+}
+
+static bool findVertexProperties(PlyVertices& vertices, std::string& error)
+{
+    const PlyElement& element = vertices.element;
+    vertices.position[0] = element.find({ "x" });
+    vertices.position[1] = element.find({ "y" });
+    vertices.position[2] = element.find({ "z" });
+    vertices.normal[0] = element.find({ "nx" });
+    vertices.normal[1] = element.find({ "ny" });
+    vertices.normal[2] = element.find({ "nz" });
+    vertices.uv[0] = element.find({ "u", "s", "texture_u", "texture_s" });
+    vertices.uv[1] = element.find({ "v", "t", "texture_v", "texture_t" });
+    if (vertices.position[0] < 0 || vertices.position[1] < 0 || vertices.position[2] < 0) {
+        error = "vertices without x, y and z";
+        return false;
+    }
+    for (auto& property : element.properties) {
+        if (property.isList) {
+            error = "list properties of vertices are not supported";
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool checkFace(const std::vector<uint32_t>& face, size_t numVertices, std::string& error)
+{
+    for (uint32_t index : face) {
+        if (index >= numVertices) {
+            error = "face index " + std::to_string(index) + " out of range";
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool loadBinary(const char* p, const char* end, bool swap, const std::vector<PlyElement>& elements, Surface& surf, std::string& error)
+{
+    PlyVertices vertices;
+    bool hasVertices = false;
+    int firstVertex = int(surf.numVertices());
+    std::vector<uint32_t> face;
+    for (const PlyElement& element : elements) {
+        if (element.name == "vertex") {
+            vertices.element = element;
+            if (!findVertexProperties(vertices, error))
+                return false;
+            if (element.count > size_t(end - p) / std::max<size_t>(element.stride, 1)) {
+                error = "file ends within the vertices";
+                return false;
+            }
+            // Read in place from the mapping
+            vertices.data = p;
+            vertices.count = element.count;
+            vertices.swap = swap;
+            hasVertices = true;
+            addVertices(surf, vertices);
+            p += element.count * element.stride;
+            continue;
+        }
+
+        if (element.stride != 0) {
+            if (element.count > size_t(end - p) / element.stride) {
+                error = "file ends within element " + element.name;
+                return false;
+            }
+            p += element.count * element.stride;
+            continue;
+        }
+
+        bool isFace = element.name == "face";
+        int indexList = isFace ? element.find({ "vertex_indices", "vertex_index" }) : -1;
+        if (isFace && (indexList < 0 || !element.properties[indexList].isList)) {
+            error = "faces without a vertex_indices list";
+            return false;
+        }
+        if (isFace && !hasVertices) {
+            error = "faces before vertices";
+            return false;
+        }
+        if (isFace)
+            surf.reserve(element.count);
+
+        for (size_t r = 0; r < element.count; r++) {
+            for (size_t i = 0; i < element.properties.size(); i++) {
+                const PlyProperty& property = element.properties[i];
+                size_t count = 1;
+                if (property.isList) {
+                    if (size_t(end - p) < plyTypeSizes[property.countType]) {
+                        error = "file ends within element " + element.name;
+                        return false;
+                    }
+                    count = size_t(readBinary(p, property.countType, swap));
+                    p += plyTypeSizes[property.countType];
+                }
+                size_t bytes = count * plyTypeSizes[property.type];
+                if (size_t(end - p) < bytes) {
+                    error = "file ends within element " + element.name;
+                    return false;
+                }
+                if (int(i) == indexList) {
+                    face.resize(count);
+                    if ((property.type == PLY_INT32 || property.type == PLY_UINT32) && !swap)
+                        memcpy(face.data(), p, bytes);
+                    else {
+                        for (size_t k = 0; k < count; k++)
+                            face[k] = uint32_t(readBinary(p + k * plyTypeSizes[property.type], property.type, swap));
+                    }
+                    if (!checkFace(face, vertices.count, error))
+                        return false;
+                    addFace(surf, firstVertex, face.data(), count);
+                }
+                p += bytes;
+            }
+        }
+    }
+    if (!hasVertices) {
+        error = "no vertex element";
+        return false;
+    }
+    return true;
+}
+
+static bool loadAscii(const char* p, const char* end, const std::vector<PlyElement>& elements, Surface& surf, std::string& error)
+{
+    PlyTokens tokens = { p, end };
+    PlyVertices vertices;
+    std::vector<float> vertexData;
+    bool hasVertices = false;
+    int firstVertex = int(surf.numVertices());
+    std::vector<uint32_t> face;
+    double value;
+    for (const PlyElement& element : elements) {
+        if (element.name == "vertex") {
+            vertices.element = element;
+            if (!findVertexProperties(vertices, error))
+                return false;
+
+            // Converted to native floats, then read like a binary file
+            size_t numProperties = element.properties.size();
+            vertexData.resize(element.count * numProperties);
+            for (size_t i = 0; i < vertexData.size(); i++) {
+                if (!tokens.next(value)) {
+                    error = "invalid vertex data";
+                    return false;
+                }
+                vertexData[i] = float(value);
+            }
+            for (size_t i = 0; i < numProperties; i++) {
+                vertices.element.properties[i].type = PLY_FLOAT32;
+                vertices.element.properties[i].offset = i * sizeof(float);
+            }
+            vertices.element.stride = numProperties * sizeof(float);
+            vertices.data = (const char*)vertexData.data();
+            vertices.count = element.count;
+            hasVertices = true;
+            addVertices(surf, vertices);
+            vertexData = std::vector<float>();
+            continue;
+        }
+
+        bool isFace = element.name == "face";
+        int indexList = isFace ? element.find({ "vertex_indices", "vertex_index" }) : -1;
+        if (isFace && (indexList < 0 || !element.properties[indexList].isList)) {
+            error = "faces without a vertex_indices list";
+            return false;
+        }
+        if (isFace && !hasVertices) {
+            error = "faces before vertices";
+            return false;
+        }
+        if (isFace)
+            surf.reserve(element.count);
+
+        for (size_t r = 0; r < element.count; r++) {
+            for (size_t i = 0; i < element.properties.size(); i++) {
+                const PlyProperty& property = element.properties[i];
+                size_t count = 1;
+                if (property.isList) {
+                    if (!tokens.next(value) || value < 0) {
+                        error = "invalid list in element " + element.name;
+                        return false;
+                    }
+                    count = size_t(value);
+                }
+                if (int(i) == indexList)
+                    face.resize(count);
+                for (size_t k = 0; k < count; k++) {
+                    if (!tokens.next(value)) {
+                        error = "invalid data in element " + element.name;
+                        return false;
+                    }
+                    if (int(i) == indexList)
+                        face[k] = value < 0 ? uint32_t(-1) : uint32_t(value);
+                }
+                if (int(i) == indexList) {
+                    if (!checkFace(face, vertices.count, error))
+                        return false;
+                    addFace(surf, firstVertex, face.data(), count);
+                }
+            }
+        }
+    }
+    if (!hasVertices) {
+        error = "no vertex element";
+        return false;
+    }
+    return true;
+}
+
+bool loadPly(std::string pathToPly, Surface& surf)
+{
+    TRACE_SCOPE("Parse PLY", pathToPly);
+    PlyFile file;
+    if (!file.open(pathToPly)) {
+        std::cerr << "Could not read " << pathToPly << std::endl;
+        return false;
+    }
+
+    const char* p = file.data;
+    const char* end = file.data + file.size;
+    PlyFormat format = PLY_ASCII;
+    std::vector<PlyElement> elements;
+    std::string error;
+    bool loaded = parseHeader(p, end, format, elements, error);
+    if (loaded && format == PLY_ASCII)
+        loaded = loadAscii(p, end, elements, surf, error);
+    else if (loaded)
+        loaded = loadBinary(p, end, (format == PLY_BINARY_LITTLE_ENDIAN) != hostIsLittleEndian(), elements, surf, error);
+
+    if (!loaded)
+        std::cerr << "PLY " << pathToPly << ": " << error << std::endl;
+    return loaded;
+}
+
+bool isPlyPath(const std::string& path)
+{
+    if (path.size() < 4)
+        return false;
+    std::string extension = path.substr(path.size() - 4);
+    for (auto& c : extension)
+        c = char(std::tolower((unsigned char)c));
+    return extension == ".ply";
+}
@@ -0,0 +1,187 @@
+#include "preview.h"
+#include "parallel.h"
+
+PreviewSession::PreviewSession(Scene& scene, long long maxSpp, ImageCallback onImage)
+    : scene(scene),
+    maxSpp(maxSpp),
+    onImage(onImage),
+    camera(scene.camera),
+    generation(0)
+{
+    this->thread = std::thread(&PreviewSession::run, this);
+}
+
+PreviewSession::~PreviewSession()
+{
+    this->stop();
+}
+
+void PreviewSession::setCamera(Camera camera)
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->camera = camera;
+    this->hasCamera = true;
+    this->generation++;
+    this->changed.notify_all();
+}
+
+void PreviewSession::waitUntilDone()
+{
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->changed.wait(lock, [&]() {
+        return this->stopping || !this->hasCamera || this->doneGeneration == this->generation;
+    });
+}
+
+void PreviewSession::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+        this->generation++;
+        this->changed.notify_all();
+    }
+    if (this->thread.joinable())
+        this->thread.join();
+}
+
+/**
+ * Adds one sample with index sampleIndex to every pixel of image, rendered
+ * through integrator's camera. Returns false if the camera changed meanwhile.
+ */
+bool PreviewSession::renderStage(Integrator& integrator, Framebuffer& image, long long sampleIndex, uint64_t generation)
+{
+    parallelFor(0, image.resolution.y, 1, [&](int begin, int end) {
+        for (int y = begin; y < end; y++) {
+            if (this->generation != generation)
+                return;
+            for (int x = 0; x < image.resolution.x; x++) {
+                int p = image.pixelIndex(x, y);
+                seed_random(this->seed, p, sampleIndex);
+                image.addSample(p, integrator.samplePixel(x, y));
+            }
+        }
+    });
+    return this->generation == generation;
+}
+
+void PreviewSession::run()
+{
+    while (true) {
+        Camera camera;
+        uint64_t generation;
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->changed.wait(lock, [&]() {
+                return this->stopping || (this->hasCamera && this->doneGeneration != this->generation);
+            });
+            if (this->stopping)
+                return;
+            camera = this->camera;
+            generation = this->generation;
+        }
+
+        auto startTime = std::chrono::high_resolution_clock::now();
+        auto elapsed = [&]() {
+            return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+        };
+
+        Vector2i res = camera.imageResolution;
+        Integrator integrator(this->scene);
+        bool first = true;
+
+        // Low resolution stages, each upsampled to the full frame
+        Framebuffer display;
+        display.allocate(res);
+        for (int scale = 8; scale >= 2; scale /= 2) {
+            Vector2i lowRes(std::max(1, res.x / scale), std::max(1, res.y / scale));
+            integrator.camera = Camera(camera.from, camera.to, camera.up, camera.fieldOfView, lowRes);
+
+            Framebuffer low;
+            low.allocate(lowRes);
+            if (!this->renderStage(integrator, low, 0, generation))
+                break;
+
+            for (int y = 0; y < res.y; y++) {
+                for (int x = 0; x < res.x; x++) {
+                    int src = low.pixelIndex(std::min(x * lowRes.x / res.x, lowRes.x - 1), std::min(y * lowRes.y / res.y, lowRes.y - 1));
+                    int dst = display.pixelIndex(x, y);
+                    display.color[3 * dst + 0] = low.color[3 * src + 0];
+                    display.color[3 * dst + 1] = low.color[3 * src + 1];
+                    display.color[3 * dst + 2] = low.color[3 * src + 2];
+                    display.sampleCount[dst] = 1;
+                }
+            }
+
+            double ms = elapsed();
+            if (first)
+                this->timesToFirstImage.push_back(ms);
+            first = false;
+            this->onImage(display, scale, 1, ms);
+        }
+
+        // Full resolution refinement, seeded like Integrator::render
+        integrator.camera = camera;
+        Framebuffer image;
+        image.allocate(res);
+        for (long long s = 0; s < this->maxSpp && this->generation == generation; s++) {
+            if (!this->renderStage(integrator, image, s, generation))
+                break;
+            this->onImage(image, 1, s + 1, elapsed());
+        }
+
+        std::lock_guard<std::mutex> lock(this->mutex);
+        if (this->generation == generation) {
+            this->doneGeneration = generation;
+            this->changed.notify_all();
+        }
+    }
+}
+
+/**
+ * Command line front end: every line on stdin is a JSON object with camera
+ * changes ("from", "to", "up", "fieldOfView", relative to the scene camera),
+ * "wait" to block until the current camera is fully refined, or "quit".
+ * The image at outPath is rewritten after every stage.
+ */
+int runPreview(Scene& scene, std::string outPath, long long maxSpp, uint64_t seed)
+{
+    std::mutex saveMutex;
+    PreviewSession session(scene, maxSpp, [&](Framebuffer& image, int scale, long long spp, double ms) {
+        std::lock_guard<std::mutex> lock(saveMutex);
+        std::cout << "Preview 1/" << scale << " resolution, " << spp << " spp after " << ms << " ms" << std::endl;
+        image.save(outPath);
+    });
+    session.seed = seed;
+    session.setCamera(scene.camera);
+
+    std::string line;
+    while (std::getline(std::cin, line)) {
+        if (line.empty())
+            continue;
+        if (line == "quit")
+            break;
+        if (line == "wait") {
+            session.waitUntilDone();
+            continue;
+        }
+
+        try {
+            session.setCamera(scene.camera.modified(nlohmann::json::parse(line), scene.imageResolution));
+        }
+        catch (nlohmann::json::exception e) {
+            std::cerr << "Could not parse camera change: " << line << std::endl;
+        }
+    }
+    if (std::cin.eof())
+        session.waitUntilDone();
+    session.stop();
+
+    double total = 0.f;
+    for (double ms : session.timesToFirstImage)
+        total += ms;
+    if (!session.timesToFirstImage.empty())
+        std::cout << "Time to first image: " << total / session.timesToFirstImage.size() << " ms average over "
+            << session.timesToFirstImage.size() << " camera changes" << std::endl;
+    return 0;
+}
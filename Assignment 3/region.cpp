@@ -0,0 +1,105 @@
+#include "region.h"
+
+bool Region::build(Vector2i resolution)
+{
+    this->resolution = resolution;
+    this->mask.assign(size_t(resolution.x) * resolution.y, 0);
+
+    for (auto r : this->rects) {
+        float sx = r.normalized ? float(resolution.x) : 1.f;
+        float sy = r.normalized ? float(resolution.y) : 1.f;
+        int x0 = std::max(0, int(std::floor(r.x0 * sx)));
+        int y0 = std::max(0, int(std::floor(r.y0 * sy)));
+        int x1 = std::min(resolution.x, int(std::ceil(r.x1 * sx)));
+        int y1 = std::min(resolution.y, int(std::ceil(r.y1 * sy)));
+
+        for (int y = y0; y < y1; y++)
+            for (int x = x0; x < x1; x++)
+                this->mask[size_t(y) * resolution.x + x] = 1;
+    }
+
+    for (auto path : this->maskPaths) {
+        Texture image(path);
+        if (image.type != TextureType::UNSIGNED_INTEGER_ALPHA) {
+            std::cerr << "Mask " << path << " should be a PNG or JPG image." << std::endl;
+            image.release();
+            return false;
+        }
+
+        // Masks are sampled with nearest neighbour if their size differs.
+        // Texture loading flips rows, so row y of the image is row (h - 1 - y).
+        uint32_t* texels = (uint32_t*)image.data;
+        for (int y = 0; y < resolution.y; y++) {
+            int my = image.resolution.y - 1 - y * image.resolution.y / resolution.y;
+            for (int x = 0; x < resolution.x; x++) {
+                int mx = x * image.resolution.x / resolution.x;
+                if (texels[size_t(my) * image.resolution.x + mx] & 0x00ffffffu)
+                    this->mask[size_t(y) * resolution.x + x] = 1;
+            }
+        }
+        image.release();
+    }
+
+    this->lower = resolution;
+    this->upper = Vector2i(0, 0);
+    for (int y = 0; y < resolution.y; y++) {
+        for (int x = 0; x < resolution.x; x++) {
+            if (!this->mask[size_t(y) * resolution.x + x])
+                continue;
+            this->lower = Vector2i(std::min(this->lower.x, x), std::min(this->lower.y, y));
+            this->upper = Vector2i(std::max(this->upper.x, x + 1), std::max(this->upper.y, y + 1));
+        }
+    }
+
+    if (this->upper.x <= this->lower.x) {
+        std::cerr << "The region of interest contains no pixels." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+long long Region::numPixels()
+{
+    long long count = 0;
+    for (uint8_t m : this->mask)
+        count += m;
+    return count;
+}
+
+bool Region::save(Framebuffer& framebuffer, std::string path)
+{
+    if (this->cropOutput) {
+        Framebuffer cropped = framebuffer.crop(this->lower, this->upper - this->lower);
+        cropped.save(path);
+        return true;
+    }
+
+    if (!this->compositePath.empty()) {
+        Texture base(this->compositePath);
+        if (base.type != TextureType::FLOAT_ALPHA || base.resolution.x != this->resolution.x
+            || base.resolution.y != this->resolution.y) {
+            std::cerr << "Composite base " << this->compositePath << " should be a float EXR of "
+                << this->resolution.x << "x" << this->resolution.y << " pixels." << std::endl;
+            base.release();
+            return false;
+        }
+
+        // Pixels outside the region take the base's value as a single sample
+        float* texels = (float*)base.data;
+        Framebuffer composite = framebuffer;
+        for (size_t p = 0; p < this->mask.size(); p++) {
+            if (this->mask[p])
+                continue;
+            composite.color[3 * p + 0] = texels[4 * p + 0];
+            composite.color[3 * p + 1] = texels[4 * p + 1];
+            composite.color[3 * p + 2] = texels[4 * p + 2];
+            composite.sampleCount[p] = 1;
+        }
+        base.release();
+        composite.save(path);
+        return true;
+    }
+
+    framebuffer.save(path);
+    return true;
+}
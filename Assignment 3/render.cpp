@@ -1,205 +1,1069 @@
 #include "render.h"
-#include <random>
+#include "checkpoint.h"
+#include "distributed.h"
+#include "memory.h"
+#include "obj.h"
+#include "parallel.h"
+#include "perf.h"
+#include "preview.h"
+#include "region.h"
+#include "server.h"
+#include "stats.h"
+#include "temporal.h"
+#include "trace.h"
+
+#include <sstream>
+#include <thread>
 
 Integrator::Integrator(Scene &scene)
+    : scene(scene),
+    camera(scene.camera)
 {
-    this->scene = scene;
-    this->outputImage.allocate(TextureType::UNSIGNED_INTEGER_ALPHA, this->scene.imageResolution);
+    for (Light &light : this->scene.lights) {
+        if (light.type == AREA_LIGHT)
+            this->numAreaLights++;
+    }
 }
 int variant = 0;
-long long Integrator::render()
+
+CheckpointHeader Integrator::checkpointSettings()
 {
-    int arealights = 0;
-    std::vector<Light> aLights;
-    for(Light &light: this->scene.lights){
-        if (light.type == AREA_LIGHT)
+    CheckpointHeader settings;
+    std::memset(&settings, 0, sizeof(settings));
+    settings.width = this->camera.imageResolution.x;
+    settings.height = this->camera.imageResolution.y;
+    settings.variant = variant;
+    settings.spp = this->spp;
+    settings.seed = this->seed;
+    settings.sceneHash = this->scene.contentHash();
+    settings.firstSample = this->firstSample;
+    settings.adaptive = this->adaptive;
+    settings.threshold = this->adaptive ? this->threshold : 0.f;
+    settings.minSpp = this->adaptive ? this->minSpp : 0;
+    settings.hasMoments = this->framebuffer.hasMoments();
+    settings.costMetric = this->costMetric;
+    return settings;
+}
+
+/**
+ * Traces a single camera sample through pixel (x, y) and returns its radiance
+ * estimate for the active sampling variant.
+ */
+Vector3f Integrator::samplePixel(int x, int y)
+{
+    Ray cameraRay = this->camera.generateRay(x, y);
+    STAT_INC(STAT_CAMERA_RAYS);
+    Interaction si = this->scene.rayIntersect(cameraRay);
+    Interaction si2 = this->scene.rayEmitterIntersect(cameraRay);
+
+    if (variant == 3) {
+        Vector3f result(0, 0, 0);
+        if(si.didIntersect){
+            // Pick one light uniformly
+            int idx = std::min(int(next_float() * this->scene.lights.size()), int(this->scene.lights.size()) - 1);
+            auto light = this->scene.lights[idx];
+            Vector3f radiance; LightSample ls;
+            if(light.type == DIRECTIONAL_LIGHT || light.type == POINT_LIGHT){
+                std::tie(radiance, ls) = light.sample(&si);
+
+                Ray shadowRay(si.p + 1e-3f * si.n, ls.wo);
+                STAT_INC(STAT_SHADOW_RAYS);
+                Interaction siShadow = this->scene.rayIntersect(shadowRay);
+
+                if (!siShadow.didIntersect || siShadow.t > ls.d)
+                {
+                    result += si.bsdf->eval(&si, si.toLocal(ls.wo)) * radiance * std::abs(Dot(si.n, ls.wo));
+                }
+            }
+            else{
+                std::tie(radiance, ls) = light.sample(&si);
+                Ray shadowRay(si.p + 1e-3f * si.n, ls.wo);
+                STAT_INC(STAT_SHADOW_RAYS);
+                Interaction siShadow = this->scene.rayIntersect(shadowRay);
+                auto center = light.center, vx = light.vx, vy = light.vy;
+                Vector3f p1 = center + vx + vy;
+                Vector3f p2 = center - vx + vy;
+                Vector3f p3 = center - vx - vy;
+                Vector3f p4 = center + vx - vy;
+                Vector3f cp = Cross(p2 - p1, p4 - p1);
+                auto area = cp.Length();
+                auto cost = std::abs(Dot(light.normal , ls.wo));
+                if (!siShadow.didIntersect || siShadow.t > ls.d)
+                {
+                    result += si.bsdf->eval(&si, ls.wo) * radiance * std::abs(Dot(si.n, ls.wo))  * area * cost;
+                }
+            }
+            result += si2.emissiveColor;
+        }
+        return result / this->scene.lights.size();
+    }
+
+    Vector3f subresult(0);
+    if (si.didIntersect)
+    {
+        Vector3f radiance;
+        LightSample ls;
+        for (Light &light : this->scene.lights)
+        {
+            if (light.type == AREA_LIGHT)
+                continue;
+            std::tie(radiance, ls) = light.sample(&si);
+
+            Ray shadowRay(si.p + 1e-3f * si.n, ls.wo);
+            STAT_INC(STAT_SHADOW_RAYS);
+            Interaction siShadow = this->scene.rayIntersect(shadowRay);
+
+            if (!siShadow.didIntersect || siShadow.t > ls.d)
+            {
+                subresult += si.bsdf->eval(&si, si.toLocal(ls.wo)) * radiance * std::abs(Dot(si.n, ls.wo));
+            }
+        }
+    }
+    if (si.didIntersect && (variant == 0 || variant == 1))
+    {
+        for (Light &light : this->scene.lights)
+        {
+            if (light.type != AREA_LIGHT)
+                continue;
+
+            // sample directions
+
+            Vector3f wo;
+            if ((variant == 0))
+            {
+                wo = si.hemisphere();
+            }
+
+            if (variant == 1)
+            {
+                wo = si.cosine_sample();
+            }
+            Ray shadowRay(si.p + 1e-5f * si.n, Normalize(si.toWorld(wo)));
+            STAT_INC(STAT_SECONDARY_RAYS);
+            Interaction siShadow = this->scene.rayEmitterIntersect(shadowRay);
+            Interaction siShadow2 = this->scene.rayIntersect(shadowRay);
+
+            if (siShadow2.didIntersect && siShadow2.t < siShadow.t)
+            {
+                continue;
+            }
+            if (siShadow.didIntersect && siShadow.t < siShadow2.t)
+            {
+                if (variant == 0)
+                {
+                    subresult += si.bsdf->eval(&si, wo) * siShadow.emissiveColor * std::abs(Dot(si.n, wo)) * 2 * M_PI;
+                }
+                if (variant == 1)
+                {
+                    subresult += si.bsdf->eval(&si, wo) * siShadow.emissiveColor*M_PI;
+                }
+            }
+        }
+        subresult/=this->numAreaLights;
+    }
+    if (si.didIntersect && (variant == 2))
+    {
+        Vector3f radiance;
+        LightSample ls;
+        for (Light &light : this->scene.lights)
         {
-            arealights++;
-            aLights.push_back(light);
+            if (light.type != AREA_LIGHT)
+                continue;
+
+            std::tie(radiance, ls) = light.sample(&si);
+            Ray shadowRay(si.p + 1e-3f * si.n, ls.wo);
+            STAT_INC(STAT_SHADOW_RAYS);
+            Interaction siShadow = this->scene.rayIntersect(shadowRay);
+            auto center = light.center, vx = light.vx, vy = light.vy;
+            Vector3f p1 = center + vx + vy;
+            Vector3f p2 = center - vx + vy;
+            Vector3f p3 = center - vx - vy;
+            Vector3f p4 = center + vx - vy;
+            Vector3f cp = Cross(p2 - p1, p4 - p1);
+            auto area = cp.Length();
+            auto cost = std::abs(Dot(light.normal , ls.wo));
+            if (!siShadow.didIntersect || siShadow.t > ls.d)
+            {
+                subresult += si.bsdf->eval(&si, ls.wo) * radiance * std::abs(Dot(si.n, ls.wo))  * area * cost;
+            }
         }
-        
     }
+
+    return subresult + si2.emissiveColor;
+}
+
+// Running count of the cost metric on the calling thread
+static inline uint64_t costCounter(CostMetric metric)
+{
+    if (metric == COST_TIME)
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+#if RENDER_STATS
+    ThreadStats& stats = threadStats();
+    return stats.counters[STAT_BVH_NODES] + stats.counters[STAT_TRIANGLE_TESTS];
+#else
+    return 0;
+#endif
+}
+
+long long Integrator::render()
+{
+    TRACE_SCOPE("Render");
     std::cout << this->spp << "\n";
     auto startTime = std::chrono::high_resolution_clock::now();
 
-    if(variant == 3){
+    // Samples are added to whatever the framebuffer already holds
+    if (this->framebuffer.sampleCount.empty())
+        this->framebuffer.allocate(this->camera.imageResolution);
+    if (this->adaptive)
+        this->framebuffer.trackMoments();
 
-        for (int x = 0; x < this->scene.imageResolution.x; x++)
-        {
-            for (int y = 0; y < this->scene.imageResolution.y; y++)
+    Vector2i res = this->framebuffer.resolution;
+    int numPixels = res.x * res.y;
+
+    // Samples added to each active pixel per pass. Checkpoints are only saved
+    // between passes, so checkpointed renders start with one sample per pass
+    // and double it while a pass takes less than a tenth of the checkpoint
+    // interval. Each pixel always sums its samples in sample order, so the
+    // pass size does not change the result.
+    long long maxSpp = this->spp;
+    long long passSpp = maxSpp;
+    bool widenPasses = false;
+    if (this->adaptive)
+        passSpp = std::min(this->minSpp, maxSpp);
+    else if (!this->checkpointPath.empty()) {
+        passSpp = 1;
+        widenPasses = true;
+    }
+
+    std::vector<uint8_t> active = this->mask;
+    if (active.empty())
+        active.assign(numPixels, 1);
+    long long numTraced = std::count(active.begin(), active.end(), 1);
+    long long pass = 0;
+
+    CheckpointHeader settings = this->checkpointSettings();
+    if (!this->resumePath.empty()) {
+        pass = Checkpoint::load(this->resumePath, settings, this->framebuffer, active);
+        if (pass < 0)
+            return -1;
+        std::cout << "Resumed from " << this->resumePath << " after " << pass << " passes" << std::endl;
+    }
+    // After the resume, which reallocates the framebuffer
+    if (this->costMetric != COST_NONE)
+        this->framebuffer.trackCost();
+
+    Checkpoint checkpoint;
+    if (!this->checkpointPath.empty() && !checkpoint.create(this->checkpointPath, settings))
+        return -1;
+    auto lastCheckpoint = std::chrono::high_resolution_clock::now();
+
+    while (std::find(active.begin(), active.end(), 1) != active.end()) {
+        TRACE_SCOPE("Pass");
+        auto passStart = std::chrono::high_resolution_clock::now();
+        parallelFor(0, res.y, 1, [&](int begin, int end) {
+            for (int y = begin; y < end; y++)
             {
-                Vector3f result(0, 0, 0);
-                for(int i=0; i<this->spp; i++){
-                    Ray cameraRay = this->scene.camera.generateRay(x, y);
-                    Interaction si = this->scene.rayIntersect(cameraRay);
-                    Interaction si2 = this->scene.rayEmitterIntersect(cameraRay);
-                    if(si.didIntersect){
-                    // https://en.cppreference.com/w/cpp/numeric/random/random_device
-                        std::random_device rd;  // a seed source for the random number engine
-                        std::mt19937 gen(rd()); // mersenne_twister_engine seeded with rd()
-                        std::uniform_int_distribution<> distrib(0, this->scene.lights.size() - 1);
-                        int idx = distrib(gen);
-                        auto light = this->scene.lights[idx];
-                        Vector3f radiance; LightSample ls;
-                        if(light.type == DIRECTIONAL_LIGHT || light.type == POINT_LIGHT){
-                            std::tie(radiance, ls) = light.sample(&si);
-
-                            Ray shadowRay(si.p + 1e-3f * si.n, ls.wo);
-                            Interaction siShadow = this->scene.rayIntersect(shadowRay);
-
-                            if (!siShadow.didIntersect || siShadow.t > ls.d)
-                            {
-                                result += si.bsdf->eval(&si, si.toLocal(ls.wo)) * radiance * std::abs(Dot(si.n, ls.wo));
-                            }
-                        }
-                        else{
-                            std::tie(radiance, ls) = light.sample(&si);
-                            Ray shadowRay(si.p + 1e-3f * si.n, ls.wo);
-                            Interaction siShadow = this->scene.rayIntersect(shadowRay);
-                            auto center = light.center, vx = light.vx, vy = light.vy;
-                            Vector3f p1 = center + vx + vy;
-                            Vector3f p2 = center - vx + vy;
-                            Vector3f p3 = center - vx - vy;
-                            Vector3f p4 = center + vx - vy;
-                            Vector3f cp = Cross(p2 - p1, p4 - p1);
-                            auto area = cp.Length();
-                            auto cost = std::abs(Dot(light.normal , ls.wo));
-                            if (!siShadow.didIntersect || siShadow.t > ls.d)
-                            {
-                                result += si.bsdf->eval(&si, ls.wo) * radiance * std::abs(Dot(si.n, ls.wo))  * area * cost;
-                            }
-                        }
-                        result += si2.emissiveColor;
+                for (int x = 0; x < res.x; x++)
+                {
+                    int p = this->framebuffer.pixelIndex(x, y);
+                    if (!active[p])
+                        continue;
+
+                    long long n = std::min(passSpp, maxSpp - (long long)this->framebuffer.sampleCount[p]);
+                    uint64_t costStart = this->costMetric != COST_NONE ? costCounter(this->costMetric) : 0;
+                    for (long long i = 0; i < n; i++) {
+                        seed_random(this->seed, p, this->firstSample + this->framebuffer.sampleCount[p]);
+                        this->framebuffer.addSample(p, this->samplePixel(x, y));
                     }
-                result /= this->spp;
-                result /= this->scene.lights.size();
-                this->outputImage.writePixelColor(result, x, y);
+                    if (this->costMetric != COST_NONE)
+                        this->framebuffer.cost[p] += costCounter(this->costMetric) - costStart;
+
+                    if (this->framebuffer.sampleCount[p] >= maxSpp
+                        || (this->adaptive && this->framebuffer.relativeError(p) <= this->threshold))
+                        active[p] = 0;
                 }
             }
-            
+        });
+        pass++;
+
+        auto now = std::chrono::high_resolution_clock::now();
+        if (widenPasses && std::chrono::duration<float>(now - passStart).count() < this->checkpointInterval / 10.f)
+            passSpp = std::min(2 * passSpp, maxSpp);
+        if (checkpoint.mapping != nullptr
+            && std::chrono::duration<float>(now - lastCheckpoint).count() >= this->checkpointInterval) {
+            checkpoint.save(this->framebuffer, active, pass);
+            lastCheckpoint = now;
         }
     }
-    else{
 
-        for (int x = 0; x < this->scene.imageResolution.x; x++)
+    if (this->adaptive) {
+        long long totalSamples = 0;
+        for (uint32_t c : this->framebuffer.sampleCount)
+            totalSamples += c;
+        std::cout << "Average spp: " << totalSamples / float(numTraced) << std::endl;
+    }
+
+    auto finishTime = std::chrono::high_resolution_clock::now();
+
+    return std::chrono::duration_cast<std::chrono::microseconds>(finishTime - startTime).count();
+}
+
+/**
+ * Renders all spp samples of every pixel of tile, whose pixel (0, 0) is image
+ * pixel origin. Samples are seeded with their image pixel index, so the sums
+ * are bit-identical to what render() accumulates for the same pixels.
+ */
+void Integrator::renderTile(Framebuffer& tile, Vector2i origin)
+{
+    int width = this->camera.imageResolution.x;
+
+    parallelFor(0, tile.resolution.y, 1, [&](int begin, int end) {
+        for (int y = begin; y < end; y++)
         {
-            for (int y = 0; y < this->scene.imageResolution.y; y++)
+            for (int x = 0; x < tile.resolution.x; x++)
             {
-                Vector3f result(0, 0, 0);
-                for (int i = 0; i < this->spp; i++)
-                {
-                    Ray cameraRay = this->scene.camera.generateRay(x, y);
-                    Interaction si = this->scene.rayIntersect(cameraRay);
-                    Interaction si2 = this->scene.rayEmitterIntersect(cameraRay);
-                    Vector3f subresult(0);
-                    if (si.didIntersect)
-                    {
-                        Vector3f radiance;
-                        LightSample ls;
-                        for (Light &light : this->scene.lights)
-                        {
-                            if (light.type == AREA_LIGHT)
-                                continue;
-                            std::tie(radiance, ls) = light.sample(&si);
-
-                            Ray shadowRay(si.p + 1e-3f * si.n, ls.wo);
-                            Interaction siShadow = this->scene.rayIntersect(shadowRay);
-
-                            if (!siShadow.didIntersect || siShadow.t > ls.d)
-                            {
-                                subresult += si.bsdf->eval(&si, si.toLocal(ls.wo)) * radiance * std::abs(Dot(si.n, ls.wo));
-                            }
-                        }
-                    }
-                    if (si.didIntersect && (variant == 0 || variant == 1))
-                    {
-                        for (Light &light : this->scene.lights)
-                        {
-                            if (light.type != AREA_LIGHT)
-                                continue;
-
-                            // sample directions
-
-                            Vector3f wo;
-                            if ((variant == 0))
-                            {
-                                wo = si.hemisphere();
-                            }
-
-                            if (variant == 1)
-                            {
-                                wo = si.cosine_sample();
-                            }
-                            Ray shadowRay(si.p + 1e-5f * si.n, Normalize(si.toWorld(wo)));
-                            Interaction siShadow = this->scene.rayEmitterIntersect(shadowRay);
-                            Interaction siShadow2 = this->scene.rayIntersect(shadowRay);
-
-                            if (siShadow2.didIntersect && siShadow2.t < siShadow.t)
-                            {
-                                continue;
-                            }
-                            if (siShadow.didIntersect && siShadow.t < siShadow2.t)
-                            {
-                                if (variant == 0)
-                                {
-                                    subresult += si.bsdf->eval(&si, wo) * siShadow.emissiveColor * std::abs(Dot(si.n, wo)) * 2 * M_PI;
-                                }
-                                if (variant == 1)
-                                {
-                                    subresult += si.bsdf->eval(&si, wo) * siShadow.emissiveColor*M_PI;
-                                }
-                            }
-                        }
-                        subresult/=arealights;
-                    }
-                    if (si.didIntersect && (variant == 2))
-                    {
-                        Vector3f radiance;
-                        LightSample ls;
-                        for (Light &light : this->scene.lights)
-                        {
-                            if (light.type != AREA_LIGHT)
-                                continue;
-
-                            std::tie(radiance, ls) = light.sample(&si);
-                            Ray shadowRay(si.p + 1e-3f * si.n, ls.wo);
-                            Interaction siShadow = this->scene.rayIntersect(shadowRay);
-                            auto center = light.center, vx = light.vx, vy = light.vy;
-                            Vector3f p1 = center + vx + vy;
-                            Vector3f p2 = center - vx + vy;
-                            Vector3f p3 = center - vx - vy;
-                            Vector3f p4 = center + vx - vy;
-                            Vector3f cp = Cross(p2 - p1, p4 - p1);
-                            auto area = cp.Length();
-                            auto cost = std::abs(Dot(light.normal , ls.wo));
-                            if (!siShadow.didIntersect || siShadow.t > ls.d)
-                            {
-                                subresult += si.bsdf->eval(&si, ls.wo) * radiance * std::abs(Dot(si.n, ls.wo))  * area * cost;
-                            }
-                        }
-                    }
-                    
-                    result += (subresult + si2.emissiveColor);
+                int p = tile.pixelIndex(x, y);
+                int imagePixel = (origin.y + y) * width + origin.x + x;
+
+                while (tile.sampleCount[p] < this->spp) {
+                    seed_random(this->seed, imagePixel, this->firstSample + tile.sampleCount[p]);
+                    tile.addSample(p, this->samplePixel(origin.x + x, origin.y + y));
                 }
+            }
+        }
+    });
+}
+
+// out.png -> out_0007.png
+static std::string framePath(std::string outPath, int frame)
+{
+    char number[16];
+    snprintf(number, sizeof(number), "_%04d", frame);
+    size_t dot = outPath.rfind('.');
+    if (dot == std::string::npos)
+        return outPath + number;
+    return outPath.substr(0, dot) + number + outPath.substr(dot);
+}
 
-                result /= this->spp;
-                this->outputImage.writePixelColor(result, x, y);
+/**
+ * Renders every camera of the scene into numbered files, sharing the loaded
+ * scene and BVH. With parallelFrames each thread renders whole frames instead
+ * of all threads working on one frame at a time.
+ */
+static int renderBatch(Scene& scene, std::string outPath, int spp, uint64_t seed,
+    bool adaptive, float threshold, long long minSpp, bool parallelFrames, Region& region)
+{
+    int numFrames = int(scene.cameras.size());
+    std::cout << "Rendering " << numFrames << " frames" << std::endl;
+
+    auto startTime = std::chrono::high_resolution_clock::now();
+    auto renderFrames = [&](int begin, int end) {
+        for (int f = begin; f < end; f++) {
+            TRACE_SCOPE("Frame");
+            Integrator rayTracer(scene);
+            rayTracer.camera = scene.cameras[f];
+            rayTracer.spp = spp;
+            rayTracer.seed = seed;
+            rayTracer.adaptive = adaptive;
+            rayTracer.threshold = threshold;
+            rayTracer.minSpp = minSpp;
+            rayTracer.mask = region.mask;
+            rayTracer.render();
+            region.save(rayTracer.framebuffer, framePath(outPath, f));
+        }
+    };
+
+    if (parallelFrames)
+        parallelFor(0, numFrames, 1, renderFrames);
+    else
+        renderFrames(0, numFrames);
+
+    auto finishTime = std::chrono::high_resolution_clock::now();
+    float ms = std::chrono::duration<float, std::milli>(finishTime - startTime).count();
+    std::cout << "Batch Time: " << ms << " ms (" << ms / numFrames << " ms per frame)" << std::endl;
+    return 0;
+}
+
+/**
+ * Appends one JSON line describing a finished render to path, see
+ * scripts/benchmark_suite.sh. bvhMs adds up the surface and scene BVH builds,
+ * perf holds the hardware counters of --perf.
+ */
+static bool writeBenchReport(std::string path, std::string scenePath, Scene& scene, int spp, uint64_t seed,
+    float loadMs, float renderMs, nlohmann::json perf)
+{
+    float bvhMs = scene.bvhBuildMs;
+    size_t triangles = 0, vertices = 0;
+    for (auto& surface : scene.surfaces) {
+        bvhMs += surface.bvhBuildMs;
+        triangles += surface.numTriangles();
+        vertices += surface.numVertices();
+    }
+    RenderStats stats = RenderStats::collect();
+
+    nlohmann::json report;
+    report["scene"] = scenePath;
+    report["resolution"] = { scene.imageResolution.x, scene.imageResolution.y };
+    report["spp"] = spp;
+    report["variant"] = variant;
+    report["seed"] = seed;
+    report["threads"] = getNumThreads();
+    report["triangles"] = triangles;
+    report["vertices"] = vertices;
+    report["surfaces"] = scene.surfaces.size();
+    report["lights"] = scene.lights.size();
+    report["loadMs"] = loadMs;
+    report["loadStages"] = {
+        { "meshFiles", scene.loadStats.meshFiles },
+        { "textures", scene.loadStats.textures },
+        { "parseMs", scene.loadStats.parseMs },
+        { "geometryMs", scene.loadStats.geometryMs },
+        { "textureMs", scene.loadStats.textureMs },
+        { "surfaceBvhMs", scene.loadStats.bvhMs },
+        { "topLevelBvhMs", scene.loadStats.topLevelBvhMs }
+    };
+    report["bvhMs"] = bvhMs;
+    report["renderMs"] = renderMs;
+    if (RENDER_STATS) {
+        report["rays"] = stats.rays();
+        report["raysPerSecond"] = renderMs > 0.f ? stats.rays() / (renderMs / 1000.0) : 0.0;
+    }
+    report["peakRssMB"] = peakRssBytes() / (1024.0 * 1024.0);
+    static const char* categories[NUM_MEMORY_CATEGORIES] = { "geometry", "triangles", "bvh", "textures", "framebuffer" };
+    for (int c = 0; c < NUM_MEMORY_CATEGORIES; c++)
+        report["peakMemoryMB"][categories[c]] = MemoryStats::peak(MemoryCategory(c)) / (1024.0 * 1024.0);
+    size_t meshBytes = MemoryStats::current(MEM_GEOMETRY) + MemoryStats::current(MEM_TRIANGLES) + MemoryStats::current(MEM_BVH);
+    report["bytesPerTriangle"] = triangles > 0 ? double(meshBytes) / triangles : 0.0;
+    if (!perf.is_null())
+        report["perf"] = perf;
+
+    std::ofstream out(path, std::ios::app);
+    if (!out) {
+        std::cerr << "Could not open " << path << std::endl;
+        return false;
+    }
+    out << report.dump() << std::endl;
+    return true;
+}
+
+/**
+ * Prints the vertex count and the tracked geometry, triangle and BVH bytes
+ * per triangle of the loaded scene, see --memory
+ */
+static void printTriangleMemory(Scene& scene)
+{
+    size_t triangles = 0, vertices = 0;
+    for (auto& surface : scene.surfaces) {
+        triangles += surface.numTriangles();
+        vertices += surface.numVertices();
+    }
+    if (triangles == 0)
+        return;
+
+    size_t geometry = MemoryStats::current(MEM_GEOMETRY), tris = MemoryStats::current(MEM_TRIANGLES), bvh = MemoryStats::current(MEM_BVH);
+    printf("%zu triangles, %zu vertices (%.2f per triangle), bytes per triangle: geometry %.1f, triangles %.1f, bvh %.1f, total %.1f\n",
+        triangles, vertices, double(vertices) / triangles, double(geometry) / triangles, double(tris) / triangles,
+        double(bvh) / triangles, double(geometry + tris + bvh) / triangles);
+}
+
+/**
+ * Batch render of a camera sequence that starts every frame from the
+ * previous frame's reprojected accumulation. With a report path, every frame
+ * is also rendered from scratch, and a CSV row compares the two: time, and
+ * RMSE against the fresh render next to the RMSE of a second fresh render
+ * with another seed, i.e. the noise level of a full re-render.
+ */
+static int renderTemporal(Scene& scene, std::string outPath, int spp, uint64_t seed, std::string reportPath)
+{
+    int numFrames = int(scene.cameras.size());
+    std::cout << "Rendering " << numFrames << " frames with temporal reuse" << std::endl;
+
+    std::ofstream report;
+    if (!reportPath.empty()) {
+        report.open(reportPath.c_str());
+        if (!report) {
+            std::cerr << "Could not open " << reportPath << std::endl;
+            return 1;
+        }
+        report << "frame,reusedPixels,tracedSpp,temporalMs,fullMs,temporalRmse,fullRmse" << std::endl;
+    }
+
+    TemporalCache cache;
+    float totalMs = 0.f;
+    for (int f = 0; f < numFrames; f++) {
+        TRACE_SCOPE("Frame");
+        auto startTime = std::chrono::high_resolution_clock::now();
+
+        Integrator rayTracer(scene);
+        rayTracer.camera = scene.cameras[f];
+        rayTracer.spp = spp;
+        rayTracer.seed = seed;
+        // Fresh samples of each frame get their own index range
+        rayTracer.firstSample = 2ll * spp * f;
+
+        long long reused = cache.reproject(scene, rayTracer.camera, spp, rayTracer.framebuffer);
+        long long historySamples = 0;
+        for (uint32_t c : rayTracer.framebuffer.sampleCount)
+            historySamples += c;
+
+        rayTracer.render();
+        cache.store(rayTracer.framebuffer);
+
+        float ms = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+        totalMs += ms;
+
+        long long totalSamples = 0;
+        for (uint32_t c : rayTracer.framebuffer.sampleCount)
+            totalSamples += c;
+        size_t numPixels = rayTracer.framebuffer.sampleCount.size();
+        float tracedSpp = (totalSamples - historySamples) / float(numPixels);
+        std::cout << "Frame " << f << ": reused " << reused << " of " << numPixels << " pixels, traced "
+            << tracedSpp << " spp in " << ms << " ms" << std::endl;
+
+        rayTracer.framebuffer.save(framePath(outPath, f));
+
+        if (report.is_open()) {
+            Integrator full(scene);
+            full.camera = scene.cameras[f];
+            full.spp = spp;
+            full.seed = seed;
+            auto fullStart = std::chrono::high_resolution_clock::now();
+            full.render();
+            float fullMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - fullStart).count();
+
+            Integrator other(scene);
+            other.camera = scene.cameras[f];
+            other.spp = spp;
+            other.seed = seed + 1;
+            other.render();
+
+            report << f << "," << reused << "," << tracedSpp << "," << ms << "," << fullMs << ","
+                << rayTracer.framebuffer.rmse(full.framebuffer) << "," << other.framebuffer.rmse(full.framebuffer) << std::endl;
+        }
+    }
+
+    std::cout << "Batch Time: " << totalMs << " ms (" << totalMs / numFrames << " ms per frame)" << std::endl;
+    return 0;
+}
+
+// Settings of a --convergence run
+struct ConvergenceSettings {
+    std::string reportPath;
+    std::string referencePath;
+    long long referenceSpp = 0;
+    std::vector<int> strategies = { 0, 1, 2, 3 };
+    float noiseTarget = 0.f;
+};
+
+/**
+ * Error against a high spp reference as a function of spp and render time.
+ * Every strategy renders the scene from scratch at 1, 2, 4, ... up to spp
+ * samples, so each point is the time a standalone render of that quality
+ * takes. The reference is rendered with the command line strategy and another
+ * seed, and saved to outPath, unless an existing one is given. The report is
+ * JSON when its name ends in .json and a CSV with one row per point otherwise.
+ */
+static int renderConvergence(Scene& scene, std::string outPath, int spp, uint64_t seed, ConvergenceSettings settings)
+{
+    Integrator reference(scene);
+    if (!settings.referencePath.empty()) {
+        if (!reference.framebuffer.loadAccumulation(settings.referencePath))
+            return 1;
+        if (reference.framebuffer.resolution.x != scene.imageResolution.x
+            || reference.framebuffer.resolution.y != scene.imageResolution.y) {
+            std::cerr << "Reference " << settings.referencePath << " does not match the scene resolution" << std::endl;
+            return 1;
+        }
+    }
+    else {
+        reference.spp = settings.referenceSpp > 0 ? settings.referenceSpp : 16ll * spp;
+        reference.seed = seed + 1;
+        auto referenceTime = reference.render();
+        std::cout << "Reference: " << reference.spp << " spp in " << referenceTime / 1000.f << " ms" << std::endl;
+        if (!reference.framebuffer.saveAccumulation(outPath))
+            return 1;
+    }
+
+    struct Point {
+        long long spp;
+        float ms, rmse, relMse;
+    };
+    int referenceVariant = variant;
+    std::vector<std::vector<Point>> series;
+    for (int strategy : settings.strategies) {
+        variant = strategy;
+        series.emplace_back();
+        for (long long n = 1; ; n = std::min<long long>(2 * n, spp)) {
+            Integrator rayTracer(scene);
+            rayTracer.spp = n;
+            rayTracer.seed = seed;
+            float ms = rayTracer.render() / 1000.f;
+
+            Point point = { n, ms, rayTracer.framebuffer.rmse(reference.framebuffer), rayTracer.framebuffer.relMse(reference.framebuffer) };
+            series.back().push_back(point);
+            std::cout << "Strategy " << strategy << ", " << n << " spp: " << ms << " ms, RMSE " << point.rmse
+                << ", relMSE " << point.relMse << std::endl;
+            if (n >= spp)
+                break;
+        }
+    }
+    variant = referenceVariant;
+
+    // Time at which relMSE reaches the target, interpolated in log-log space
+    // between the two points around it, negative if never reached
+    auto timeToTarget = [&](std::vector<Point>& points) {
+        for (size_t i = 0; i < points.size(); i++) {
+            if (points[i].relMse > settings.noiseTarget)
+                continue;
+            if (i == 0 || points[i].relMse <= 0.f)
+                return points[i].ms;
+            Point& a = points[i - 1];
+            Point& b = points[i];
+            float t = std::log(a.relMse / settings.noiseTarget) / std::log(a.relMse / b.relMse);
+            return std::exp(std::log(a.ms) + t * (std::log(b.ms) - std::log(a.ms)));
+        }
+        return -1.f;
+    };
+
+    nlohmann::json json;
+    json["scene"] = scene.configPath;
+    json["referenceSpp"] = settings.referencePath.empty() ? reference.spp : -1;
+    json["referenceVariant"] = referenceVariant;
+    json["seed"] = seed;
+    std::ostringstream csv;
+    csv << "strategy,spp,ms,rmse,relMse" << std::endl;
+
+    int cheapest = -1;
+    float cheapestMs = 0.f;
+    for (size_t s = 0; s < series.size(); s++) {
+        nlohmann::json entry;
+        entry["strategy"] = settings.strategies[s];
+        for (Point& point : series[s]) {
+            entry["points"].push_back({ { "spp", point.spp }, { "ms", point.ms }, { "rmse", point.rmse }, { "relMse", point.relMse } });
+            csv << settings.strategies[s] << "," << point.spp << "," << point.ms << "," << point.rmse << "," << point.relMse << std::endl;
+        }
+        if (settings.noiseTarget > 0.f) {
+            float ms = timeToTarget(series[s]);
+            entry["msToTarget"] = ms >= 0.f ? nlohmann::json(ms) : nlohmann::json(nullptr);
+            std::cout << "Strategy " << settings.strategies[s] << ": relMSE " << settings.noiseTarget << " "
+                << (ms >= 0.f ? "after " + std::to_string(ms) + " ms" : std::string("not reached")) << std::endl;
+            if (ms >= 0.f && (cheapest < 0 || ms < cheapestMs)) {
+                cheapest = settings.strategies[s];
+                cheapestMs = ms;
             }
         }
+        json["strategies"].push_back(entry);
+    }
+    if (settings.noiseTarget > 0.f) {
+        json["noiseTarget"] = settings.noiseTarget;
+        json["cheapestStrategy"] = cheapest >= 0 ? nlohmann::json(cheapest) : nlohmann::json(nullptr);
+        if (cheapest >= 0)
+            std::cout << "Cheapest strategy for the target: " << cheapest << std::endl;
     }
-    auto finishTime = std::chrono::high_resolution_clock::now();
 
-    return std::chrono::duration_cast<std::chrono::microseconds>(finishTime - startTime).count();
+    std::ofstream report(settings.reportPath.c_str());
+    if (!report) {
+        std::cerr << "Could not open " << settings.reportPath << std::endl;
+        return 1;
+    }
+    std::string extension = settings.reportPath.size() >= 5 ? settings.reportPath.substr(settings.reportPath.size() - 5) : "";
+    if (extension == ".json")
+        report << json.dump(1) << std::endl;
+    else
+        report << csv.str();
+    return 0;
 }
 
 int main(int argc, char **argv)
 {
-    if (argc != 5)
+    if (argc >= 3 && std::string(argv[1]) == "--worker")
+    {
+        if (argc >= 5 && std::string(argv[3]) == "--threads")
+            setNumThreads(atoi(argv[4]));
+        return runWorker(argv[2]);
+    }
+    if (argc >= 3 && std::string(argv[1]) == "--serve")
+    {
+        RenderServer server;
+        server.address = argv[2];
+        for (int i = 3; i + 1 < argc; i += 2) {
+            std::string arg = argv[i];
+            if (arg == "--cache-budget")
+                server.cache.budget = size_t(atof(argv[i + 1]) * 1024 * 1024);
+            else if (arg == "--threads")
+                setNumThreads(atoi(argv[i + 1]));
+        }
+        return server.run();
+    }
+    if (argc >= 4 && std::string(argv[1]) == "--client")
+    {
+        std::string outPath;
+        int repeat = 1;
+        for (int i = 4; i + 1 < argc; i += 2) {
+            std::string arg = argv[i];
+            if (arg == "--out")
+                outPath = argv[i + 1];
+            else if (arg == "--repeat")
+                repeat = atoi(argv[i + 1]);
+        }
+        return runClient(argv[2], argv[3], outPath, repeat);
+    }
+    if (argc < 5)
+    {
+        std::cerr << "Usage: ./render <scene_config> <out_path> <num_samples> <sampling_strategy> [options]\n"
+                  << "       ./render --worker <address> [--threads <n>]\n"
+                  << "       ./render --serve <address> [--cache-budget <MB>] [--threads <n>]\n"
+                  << "       ./render --client <address> <request.json> [--out <path>] [--repeat <n>]\n"
+                  << "Options:\n"
+                  << "  --adaptive <threshold> <min_spp>  Adaptive sampling, <num_samples> is the per-pixel maximum\n"
+                  << "  --seed <n>                        Seed of the per-sample random streams\n"
+                  << "  --checkpoint <file> <seconds>     Save the render state to <file> at most every <seconds>\n"
+                  << "  --resume <file>                   Continue from a checkpoint written with the same settings\n"
+                  << "  --threads <n>                     Worker threads (default: all cores)\n"
+                  << "  --samples <begin> <end>           Render only sample indices [begin, end) of every pixel\n"
+                  << "  --shard <k> <n>                   Render the k-th of n disjoint sample ranges of <num_samples>\n"
+                  << "                                    (sharded renders write sums and counts, merge with ./merge)\n"
+                  << "  --coordinator <address>           Distribute tiles to workers connecting to <address>\n"
+                  << "                                    (unix:<path> or <host>:<port>)\n"
+                  << "  --spawn <n>                       Start <n> local worker processes\n"
+                  << "  --tile-size <n>                   Tile edge length in pixels (default: 32)\n"
+                  << "  --lease-timeout <seconds>         Reissue tiles not returned in time (default: 120)\n"
+                  << "  --report <file>                   Append distributed render statistics as JSON\n"
+                  << "  --crop <x0> <y0> <x1> <y1>        Trace only this pixel rectangle (may be repeated)\n"
+                  << "  --crop-norm <x0> <y0> <x1> <y1>   Same in normalized [0, 1] image coordinates\n"
+                  << "  --roi-mask <image>                Trace only the non-black pixels of a PNG/JPG mask\n"
+                  << "  --crop-output                     Write only the bounding box of the traced region\n"
+                  << "  --composite <image.exr>           Write the traced region over an existing float image\n"
+                  << "  --batch                           Render every camera of the scene to numbered outputs\n"
+                  << "  --temporal                        Batch mode reusing the previous frame's samples\n"
+                  << "  --temporal-report <file>          Same, also compare every frame to a full re-render (CSV)\n"
+                  << "  --preview                         Progressive preview, reads camera changes from stdin\n"
+                  << "  --watch <seconds>                 Re-render whenever the scene files change\n"
+                  << "  --stats <file.json>               Write ray and traversal counters and rays/sec\n"
+                  << "  --heatmap <time|traversal>        Write the per-pixel cost as <out>_cost.exr/.png\n"
+                  << "  --trace <file.json>               Write a Chrome trace of loading and rendering\n"
+                  << "  --bench-report <file>             Append load, BVH and render times, rays and peak memory as JSON\n"
+                  << "  --perf                            Read hardware counters around loading, BVH builds and rendering\n"
+                  << "  --memory                          Print memory per category after loading and rendering\n"
+                  << "  --memory-budget <MB>              Exit with a memory breakdown once tracked memory exceeds MB\n"
+                  << "  --obj-parser <fast|tinyobj>       OBJ parser (default: fast, falls back to tinyobj)\n"
+                  << "  --vertex-encoding <mode>          float, compact (16-bit uvs) or compact-positions\n"
+                  << "  --convergence <report>            Error vs spp and time of each strategy against a reference\n"
+                  << "                                    saved to <out_path> (CSV, or JSON if <report> ends in .json)\n"
+                  << "  --reference <image.exr>           Use an existing reference instead of rendering one\n"
+                  << "  --reference-spp <n>               Samples of the reference (default: 16 * <num_samples>)\n"
+                  << "  --strategies <list>               Strategies to compare, e.g. 0,2,3 (default: 0,1,2,3)\n"
+                  << "  --noise-target <relMSE>           Report the time each strategy needs to reach this relMSE\n"
+                  << "  --parallel-frames                 Batch mode rendering one frame per thread\n";
+        return 1;
+    }
+    int spp = atoi(argv[3]);
+    variant = atoi(argv[4]);
+
+    bool adaptive = false;
+    float threshold = 0.05f;
+    long long minSpp = 16;
+    uint64_t seed = 0;
+    std::string checkpointPath, resumePath;
+    float checkpointInterval = 300.f;
+
+    // Sample range of a shard, [0, spp) for a full render
+    long long sampleBegin = 0, sampleEnd = spp;
+    bool sharded = false;
+
+    bool distributed = false;
+    Coordinator coordinator;
+
+    bool batch = false, parallelFrames = false;
+    bool preview = false;
+    bool temporal = false;
+    float watchInterval = 0.f;
+    std::string statsPath;
+    std::string tracePath;
+    std::string benchReportPath;
+    bool perf = false;
+    bool memoryReport = false;
+    CostMetric costMetric = COST_NONE;
+    std::string temporalReport;
+    ConvergenceSettings convergence;
+    Region region;
+
+    for (int i = 5; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--adaptive" && i + 2 < argc) {
+            adaptive = true;
+            threshold = atof(argv[++i]);
+            minSpp = std::max(2, atoi(argv[++i]));
+        }
+        else if (arg == "--seed" && i + 1 < argc) {
+            seed = strtoull(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--checkpoint" && i + 2 < argc) {
+            checkpointPath = argv[++i];
+            checkpointInterval = atof(argv[++i]);
+        }
+        else if (arg == "--resume" && i + 1 < argc) {
+            resumePath = argv[++i];
+        }
+        else if (arg == "--threads" && i + 1 < argc) {
+            setNumThreads(atoi(argv[++i]));
+        }
+        else if (arg == "--samples" && i + 2 < argc) {
+            sharded = true;
+            sampleBegin = atoll(argv[++i]);
+            sampleEnd = atoll(argv[++i]);
+        }
+        else if (arg == "--shard" && i + 2 < argc) {
+            sharded = true;
+            long long k = atoll(argv[++i]), n = atoll(argv[++i]);
+            if (n <= 0 || k < 0 || k >= n) {
+                std::cerr << "--shard expects 0 <= k < n" << std::endl;
+                return 1;
+            }
+            sampleBegin = k * spp / n;
+            sampleEnd = (k + 1) * spp / n;
+        }
+        else if (arg == "--coordinator" && i + 1 < argc) {
+            distributed = true;
+            coordinator.address = argv[++i];
+        }
+        else if (arg == "--spawn" && i + 1 < argc) {
+            coordinator.spawnWorkers = atoi(argv[++i]);
+        }
+        else if (arg == "--tile-size" && i + 1 < argc) {
+            coordinator.tileSize = std::max(1, atoi(argv[++i]));
+        }
+        else if (arg == "--lease-timeout" && i + 1 < argc) {
+            coordinator.leaseTimeout = atof(argv[++i]);
+        }
+        else if (arg == "--report" && i + 1 < argc) {
+            coordinator.reportPath = argv[++i];
+        }
+        else if ((arg == "--crop" || arg == "--crop-norm") && i + 4 < argc) {
+            Region::Rect rect;
+            rect.x0 = atof(argv[++i]);
+            rect.y0 = atof(argv[++i]);
+            rect.x1 = atof(argv[++i]);
+            rect.y1 = atof(argv[++i]);
+            rect.normalized = arg == "--crop-norm";
+            region.rects.push_back(rect);
+        }
+        else if (arg == "--roi-mask" && i + 1 < argc) {
+            region.maskPaths.push_back(argv[++i]);
+        }
+        else if (arg == "--crop-output") {
+            region.cropOutput = true;
+        }
+        else if (arg == "--composite" && i + 1 < argc) {
+            region.compositePath = argv[++i];
+        }
+        else if (arg == "--temporal") {
+            batch = true;
+            temporal = true;
+        }
+        else if (arg == "--temporal-report" && i + 1 < argc) {
+            batch = true;
+            temporal = true;
+            temporalReport = argv[++i];
+        }
+        else if (arg == "--heatmap" && i + 1 < argc) {
+            std::string metric = argv[++i];
+            if (metric == "time")
+                costMetric = COST_TIME;
+            else if (metric == "traversal" && RENDER_STATS)
+                costMetric = COST_TRAVERSAL;
+            else {
+                std::cerr << "--heatmap expects time or traversal (traversal needs RENDER_STATS=ON)" << std::endl;
+                return 1;
+            }
+        }
+        else if (arg == "--trace" && i + 1 < argc) {
+            tracePath = argv[++i];
+        }
+        else if (arg == "--stats" && i + 1 < argc) {
+            statsPath = argv[++i];
+        }
+        else if (arg == "--bench-report" && i + 1 < argc) {
+            benchReportPath = argv[++i];
+        }
+        else if (arg == "--perf") {
+            perf = true;
+        }
+        else if (arg == "--memory") {
+            memoryReport = true;
+        }
+        else if (arg == "--memory-budget" && i + 1 < argc) {
+            MemoryStats::setBudget(size_t(atof(argv[++i]) * 1024 * 1024));
+        }
+        else if (arg == "--obj-parser" && i + 1 < argc) {
+            std::string parser = argv[++i];
+            if (parser == "fast")
+                objParser = OBJ_PARSER_FAST;
+            else if (parser == "tinyobj")
+                objParser = OBJ_PARSER_TINYOBJ;
+            else {
+                std::cerr << "--obj-parser expects fast or tinyobj" << std::endl;
+                return 1;
+            }
+        }
+        else if (arg == "--vertex-encoding" && i + 1 < argc) {
+            std::string encoding = argv[++i];
+            if (encoding == "float")
+                vertexEncoding = VERTEX_FLOAT;
+            else if (encoding == "compact")
+                vertexEncoding = VERTEX_COMPACT;
+            else if (encoding == "compact-positions")
+                vertexEncoding = VERTEX_COMPACT_POSITIONS;
+            else {
+                std::cerr << "--vertex-encoding expects float, compact or compact-positions" << std::endl;
+                return 1;
+            }
+        }
+        else if (arg == "--convergence" && i + 1 < argc) {
+            convergence.reportPath = argv[++i];
+        }
+        else if (arg == "--reference" && i + 1 < argc) {
+            convergence.referencePath = argv[++i];
+        }
+        else if (arg == "--reference-spp" && i + 1 < argc) {
+            convergence.referenceSpp = atoll(argv[++i]);
+        }
+        else if (arg == "--strategies" && i + 1 < argc) {
+            convergence.strategies.clear();
+            std::stringstream list(argv[++i]);
+            std::string item;
+            while (std::getline(list, item, ','))
+                convergence.strategies.push_back(atoi(item.c_str()));
+        }
+        else if (arg == "--noise-target" && i + 1 < argc) {
+            convergence.noiseTarget = atof(argv[++i]);
+        }
+        else if (arg == "--watch" && i + 1 < argc) {
+            watchInterval = atof(argv[++i]);
+        }
+        else if (arg == "--preview") {
+            preview = true;
+        }
+        else if (arg == "--batch") {
+            batch = true;
+        }
+        else if (arg == "--parallel-frames") {
+            batch = true;
+            parallelFrames = true;
+        }
+        else {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            return 1;
+        }
+    }
+
+    // Written when main returns
+    std::unique_ptr<TraceSession> trace;
+    if (!tracePath.empty())
+        trace.reset(new TraceSession(tracePath));
+
+    if (sharded) {
+        if (sampleBegin < 0 || sampleEnd <= sampleBegin) {
+            std::cerr << "Empty sample range [" << sampleBegin << ", " << sampleEnd << ")" << std::endl;
+            return 1;
+        }
+        if (adaptive || distributed) {
+            std::cerr << "Sharded renders cannot be adaptive or distributed." << std::endl;
+            return 1;
+        }
+        std::cout << "Rendering samples [" << sampleBegin << ", " << sampleEnd << ")" << std::endl;
+    }
+
+    if ((region.cropOutput || !region.compositePath.empty()) && !region.enabled()) {
+        std::cerr << "--crop-output and --composite need a --crop, --crop-norm or --roi-mask region." << std::endl;
+        return 1;
+    }
+    if (region.enabled() && (distributed || (sharded && (region.cropOutput || !region.compositePath.empty())))) {
+        std::cerr << "Regions of interest cannot be distributed, and shards are always written full size." << std::endl;
+        return 1;
+    }
+
+    if (preview && (batch || sharded || distributed || adaptive || region.enabled()
+        || !checkpointPath.empty() || !resumePath.empty())) {
+        std::cerr << "Preview mode cannot be combined with other render modes." << std::endl;
+        return 1;
+    }
+
+    if (temporal && (parallelFrames || adaptive || region.enabled())) {
+        std::cerr << "Temporal reuse renders frames in order without adaptive sampling or regions." << std::endl;
+        return 1;
+    }
+
+    if (watchInterval > 0.f && (batch || preview || sharded || distributed || !checkpointPath.empty() || !resumePath.empty())) {
+        std::cerr << "Watch mode renders single images only." << std::endl;
+        return 1;
+    }
+
+    if (batch && (sharded || distributed || !checkpointPath.empty() || !resumePath.empty())) {
+        std::cerr << "Batch mode cannot be combined with shards, checkpoints or distributed rendering." << std::endl;
+        return 1;
+    }
+
+    if (distributed)
     {
-        std::cerr << "Usage: ./render <scene_config> <out_path> <num_samples> <sampling_strategy>\n";
+        if (adaptive || !checkpointPath.empty() || !resumePath.empty()) {
+            std::cerr << "Adaptive sampling and checkpoints are not supported in distributed mode." << std::endl;
+            return 1;
+        }
+        coordinator.spp = spp;
+        coordinator.seed = seed;
+        coordinator.executable = argv[0];
+#ifdef __linux__
+        coordinator.executable = "/proc/self/exe";
+#endif
+        auto renderTime = coordinator.render(argv[1]);
+        if (renderTime < 0)
+            return 1;
+
+        std::cout << "Render Time: " << std::to_string(renderTime / 1000.f) << " ms" << std::endl;
+        coordinator.framebuffer.save(argv[2]);
+        return 0;
+    }
+
+    PerfCounters counters;
+    nlohmann::json perfReport;
+    if (perf && !counters.open()) {
+        std::cerr << "Hardware counters unavailable, " << counters.error << std::endl;
+        perfReport["error"] = counters.error;
+    }
+
+    counters.start();
+    auto loadStart = std::chrono::high_resolution_clock::now();
+    Scene scene;
+    try {
+        scene = Scene(argv[1]);
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
         return 1;
     }
-    Scene scene(argv[1]);
+    float loadMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - loadStart).count();
+    scene.loadStats.print();
+    if (memoryReport) {
+        MemoryStats::print("after load", std::cout);
+        printTriangleMemory(scene);
+    }
+
+    if (counters.available()) {
+        perfReport["load"] = PerfCounters::toJson(counters.stop(), {});
+
+        // Loading interleaves parsing and BVH builds, so the BVHs are built
+        // once more on their own. The resulting hierarchies are the same.
+        size_t triangles = 0;
+        counters.start();
+        for (auto& surface : scene.surfaces) {
+            surface.buildBVH();
+            triangles += surface.numTriangles();
+        }
+        scene.buildBVH();
+        perfReport["bvh"] = PerfCounters::toJson(counters.stop(), { { "perTriangle", double(triangles) } });
+    }
     for (auto light : scene.lights)
     {
         if (light.type == AREA_LIGHT)
@@ -207,14 +1071,101 @@ int main(int argc, char **argv)
             light.normal.Print();
         }
     }
-    Integrator rayTracer(scene);
-    int spp = atoi(argv[3]);
-    variant = atoi(argv[4]);
-    rayTracer.spp = spp;
-    auto renderTime = rayTracer.render();
+    if (preview)
+        return runPreview(scene, argv[2], spp, seed);
+
+    if (region.enabled()) {
+        if (!region.build(scene.imageResolution))
+            return 1;
+        std::cout << "Tracing " << region.numPixels() << " of "
+            << scene.imageResolution.x * scene.imageResolution.y << " pixels" << std::endl;
+    }
+
+    if (temporal)
+        return renderTemporal(scene, argv[2], spp, seed, temporalReport);
+    if (!convergence.reportPath.empty())
+        return renderConvergence(scene, argv[2], spp, seed, convergence);
+    if (batch)
+        return renderBatch(scene, argv[2], spp, seed, adaptive, threshold, minSpp, parallelFrames, region);
+
+    auto renderImage = [&]() {
+        Integrator rayTracer(scene);
+        rayTracer.spp = sampleEnd - sampleBegin;
+        rayTracer.firstSample = sampleBegin;
+        rayTracer.adaptive = adaptive;
+        rayTracer.threshold = threshold;
+        rayTracer.minSpp = minSpp;
+        rayTracer.seed = seed;
+        rayTracer.checkpointPath = checkpointPath;
+        rayTracer.checkpointInterval = checkpointInterval;
+        rayTracer.resumePath = resumePath;
+        rayTracer.mask = region.mask;
+        rayTracer.costMetric = costMetric;
+
+        RenderStats::reset();
+        counters.start();
+        auto renderTime = rayTracer.render();
+        if (renderTime < 0)
+            return false;
+        if (counters.available()) {
+            PerfCounters::Phase phase = counters.stop();
+            RenderStats stats = RenderStats::collect();
+            perfReport["render"] = PerfCounters::toJson(phase, {
+                { "perRay", double(stats.rays()) },
+                { "perTriangleTest", double(stats.counters[STAT_TRIANGLE_TESTS]) }
+            });
+            std::cout << "Counters: " << perfReport["render"].dump() << std::endl;
+        }
+
+        std::cout << "Render Time: " << std::to_string(renderTime / 1000.f) << " ms" << std::endl;
+        if (memoryReport)
+            MemoryStats::print("after render", std::cout);
+        if (!statsPath.empty()) {
+            RenderStats stats = RenderStats::collect();
+            if (!RENDER_STATS)
+                std::cerr << "Ray statistics are compiled out, configure with -DRENDER_STATS=ON" << std::endl;
+            std::cout << "Rays: " << stats.rays() << " (" << stats.rays() / (renderTime / 1e6) / 1e6 << " Mrays/s)" << std::endl;
+            stats.writeJson(statsPath, renderTime / 1e6);
+        }
+        if (!benchReportPath.empty() && !writeBenchReport(benchReportPath, argv[1], scene, spp, seed, loadMs, renderTime / 1000.f, perfReport))
+            return false;
+        if (sharded) {
+            if (!rayTracer.framebuffer.saveAccumulation(argv[2]))
+                return false;
+        }
+        else if (!region.save(rayTracer.framebuffer, argv[2])) {
+            return false;
+        }
+
+        // AOVs go next to the image, e.g. out.png -> out_spp.exr
+        std::string outPath = argv[2];
+        size_t dot = outPath.rfind('.');
+        std::string stem = dot == std::string::npos ? outPath : outPath.substr(0, dot);
+        if (rayTracer.adaptive)
+            rayTracer.framebuffer.saveSampleCounts(stem + "_spp.exr");
+        if (rayTracer.framebuffer.hasCost())
+            rayTracer.framebuffer.saveCost(stem);
+        return true;
+    };
 
-    std::cout << "Render Time: " << std::to_string(renderTime / 1000.f) << " ms" << std::endl;
-    rayTracer.outputImage.save(argv[2]);
+    if (!renderImage())
+        return 1;
+
+    // Watch mode: poll the scene's files and render again after edits
+    while (watchInterval > 0.f) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(int(watchInterval * 1000)));
+        ReloadStats stats = scene.reload();
+        if (!stats.changed())
+            continue;
+
+        std::cout << "Scene changed: " << stats.reparsedFiles << " OBJ files reloaded, " << stats.keptFiles << " kept"
+            << (stats.lights ? ", lights" : "") << (stats.cameras ? ", cameras" : "")
+            << (stats.bvhRefit ? ", BVH refit" : "") << (stats.bvhRebuilt ? ", BVH rebuilt" : "") << std::endl;
+        if (region.enabled() && !region.build(scene.imageResolution))
+            return 1;
+        if (!renderImage())
+            return 1;
+    }
 
     return 0;
 }
@@ -1,4 +1,11 @@
 #include "scene.h"
+#include "parallel.h"
+#include "stats.h"
+#include "trace.h"
+
+#include <iterator>
+#include <stdexcept>
+#include <sys/stat.h>
 
 Scene::Scene(std::string sceneDirectory, std::string sceneJson)
 {
@@ -6,9 +13,8 @@ Scene::Scene(std::string sceneDirectory, std::string sceneJson)
     try {
         sceneConfig = nlohmann::json::parse(sceneJson);
     }
-    catch (std::runtime_error e) {
-        std::cerr << "Could not parse json." << std::endl;
-        exit(1);
+    catch (const std::exception& e) {
+        throw std::runtime_error("Could not parse json.");
     }
 
     this->parse(sceneDirectory, sceneConfig);
@@ -30,90 +36,339 @@ Scene::Scene(std::string pathToJson)
 
     nlohmann::json sceneConfig;
     try {
+        TRACE_SCOPE("Read scene JSON", pathToJson);
         std::ifstream sceneStream(pathToJson.c_str());
         sceneStream >> sceneConfig;
     }
-    catch (std::runtime_error e) {
-        std::cerr << "Could not load scene .json file." << std::endl;
-        exit(1);
+    catch (const std::exception& e) {
+        throw std::runtime_error("Could not load scene .json file.");
     }
 
+    this->configPath = pathToJson;
     this->parse(sceneDirectory, sceneConfig);
 }
 
+Scene::Scene(Scene&& other)
+{
+    *this = std::move(other);
+}
+
+/**
+ * Takes over the surfaces and BVH nodes of other, which is left without BVH
+ * nodes. Whatever this scene held before has to be released first.
+ */
+Scene& Scene::operator=(Scene&& other)
+{
+    if (this == &other)
+        return *this;
+
+    this->surfaces = std::move(other.surfaces);
+    this->surfaceIdxs = std::move(other.surfaceIdxs);
+    this->lights = std::move(other.lights);
+    this->camera = other.camera;
+    this->cameras = std::move(other.cameras);
+    this->imageResolution = other.imageResolution;
+
+    this->bbox = other.bbox;
+    this->nodes = other.nodes;
+    this->numBVHNodes = other.numBVHNodes;
+    this->bvhBuildMs = other.bvhBuildMs;
+    other.nodes = nullptr;
+    other.numBVHNodes = 0;
+
+    this->configPath = std::move(other.configPath);
+    this->sceneDirectory = std::move(other.sceneDirectory);
+    this->sources = std::move(other.sources);
+    this->cameraHash = other.cameraHash;
+    this->lightHash = other.lightHash;
+    this->surfaceListHash = other.surfaceListHash;
+    this->loadStats = other.loadStats;
+    return *this;
+}
+
+static Camera parseCamera(nlohmann::json cam, Vector2i imageResolution)
+{
+    return Camera(
+        Vector3f(cam["from"][0], cam["from"][1], cam["from"][2]),
+        Vector3f(cam["to"][0], cam["to"][1], cam["to"][2]),
+        Vector3f(cam["up"][0], cam["up"][1], cam["up"][2]),
+        float(cam["fieldOfView"]),
+        imageResolution
+    );
+}
+
 void Scene::parse(std::string sceneDirectory, nlohmann::json sceneConfig)
 {
+    TRACE_SCOPE("Parse scene");
+    auto startTime = std::chrono::high_resolution_clock::now();
+    this->sceneDirectory = sceneDirectory;
+
+    if (!this->parseCameras(sceneConfig) || !this->parseLights(sceneConfig))
+        throw std::runtime_error("Invalid cameras or lights in the scene file.");
+    this->parseSurfaces(sceneConfig, nullptr);
+
+    // Build the top-level BVH once every surface BVH is done
+    this->buildBVH();
+    this->loadStats.wallMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+}
+
+void LoadStats::print()
+{
+    std::cout << "Scene loaded in " << this->wallMs << " ms on " << getNumThreads() << " threads: "
+        << this->meshFiles << " mesh files parsed in " << this->parseMs << " ms, geometry " << this->geometryMs
+        << " ms, " << this->textures << " textures decoded in " << this->textureMs << " ms, surface BVHs "
+        << this->bvhMs << " ms, top-level BVH " << this->topLevelBvhMs << " ms (stage times summed over threads)" << std::endl;
+}
+
+static size_t sectionHash(nlohmann::json& sceneConfig, std::vector<std::string> keys)
+{
+    std::string text;
+    for (auto& key : keys)
+        text += sceneConfig.count(key) ? sceneConfig[key].dump() : std::string("-");
+    return std::hash<std::string>()(text);
+}
+
+static const std::vector<std::string> cameraSections = { "output", "camera", "cameras", "turntable" };
+static const std::vector<std::string> lightSections = { "pointLights", "directionalLights", "areaLights" };
+
+/**
+ * Parses the resolution and cameras. On an invalid section the message is
+ * printed and the current cameras are kept.
+ *
+ * \return
+ * false if the section is invalid
+ */
+bool Scene::parseCameras(nlohmann::json sceneConfig)
+{
+    size_t cameraHash = sectionHash(sceneConfig, cameraSections);
+
     // Output
+    Vector2i imageResolution;
     try {
         auto res = sceneConfig["output"]["resolution"];
-        this->imageResolution = Vector2i(res[0], res[1]);
+        imageResolution = Vector2i(res[0], res[1]);
     }
     catch (nlohmann::json::exception e) {
         std::cerr << "\"output\" field with resolution, filename & spp should be defined in the scene file." << std::endl;
-        exit(1);
+        return false;
     }
 
     // Cameras
+    std::vector<Camera> cameras;
     try {
-        auto cam = sceneConfig["camera"];
-
-        this->camera = Camera(
-            Vector3f(cam["from"][0], cam["from"][1], cam["from"][2]),
-            Vector3f(cam["to"][0], cam["to"][1], cam["to"][2]),
-            Vector3f(cam["up"][0], cam["up"][1], cam["up"][2]),
-            float(cam["fieldOfView"]),
-            this->imageResolution
-        );
+        if (sceneConfig.count("cameras")) {
+            for (auto cam : sceneConfig["cameras"])
+                cameras.push_back(parseCamera(cam, imageResolution));
+        }
+        else {
+            cameras.push_back(parseCamera(sceneConfig["camera"], imageResolution));
+        }
+
+        // Turntable: orbit the first camera's eye point around its target
+        if (sceneConfig.count("turntable") && !cameras.empty()) {
+            auto turntable = sceneConfig["turntable"];
+            int frames = turntable.value("frames", 36);
+            float degrees = turntable.value("degrees", 360.f);
+            Camera base = cameras[0];
+            Vector3f axis = Normalize(base.up);
+            Vector3f offset = base.from - base.to;
+
+            cameras.clear();
+            for (int f = 0; f < frames; f++) {
+                // Rodrigues' rotation of the offset about the up axis
+                float theta = degrees * M_PI / 180.f * f / frames;
+                float c = std::cos(theta), s = std::sin(theta);
+                Vector3f rotated = offset * c + Cross(axis, offset) * s + axis * Dot(axis, offset) * (1.f - c);
+                cameras.push_back(Camera(base.to + rotated, base.to, base.up, base.fieldOfView, imageResolution));
+            }
+        }
     }
     catch (nlohmann::json::exception e) {
         std::cerr << "No camera(s) defined. Atleast one camera should be defined." << std::endl;
-        exit(1);
+        return false;
+    }
+    if (cameras.empty()) {
+        std::cerr << "No camera(s) defined. Atleast one camera should be defined." << std::endl;
+        return false;
     }
 
+    this->cameraHash = cameraHash;
+    this->imageResolution = imageResolution;
+    this->cameras.swap(cameras);
+    this->camera = this->cameras[0];
+    return true;
+}
+
+/**
+ * Parses the point, directional and area lights. Missing sections are
+ * empty. If a section is invalid, the message is printed and the current
+ * lights are kept.
+ *
+ * \return
+ * false if a section is invalid
+ */
+bool Scene::parseLights(nlohmann::json sceneConfig)
+{
+    TRACE_SCOPE("Parse lights");
+    size_t lightHash = sectionHash(sceneConfig, lightSections);
+    std::vector<Light> lights;
+
     // Point Lights
     try {
         auto pointLights = sceneConfig["pointLights"];
         for (auto l : pointLights)
-            this->lights.push_back(Light(LightType::POINT_LIGHT, l));
+            lights.push_back(Light(LightType::POINT_LIGHT, l));
     }
     catch (nlohmann::json::exception e) {
-        std::cerr << "No point lights defined." << std::endl;
+        std::cerr << "Invalid point lights." << std::endl;
+        return false;
     }
 
     // Directional Lights
     try {
         auto directionalLights = sceneConfig["directionalLights"];
         for (auto l : directionalLights)
-            this->lights.push_back(Light(LightType::DIRECTIONAL_LIGHT, l));
+            lights.push_back(Light(LightType::DIRECTIONAL_LIGHT, l));
     }
     catch (nlohmann::json::exception e) {
-        std::cerr << "No directional lights defined." << std::endl;
+        std::cerr << "Invalid directional lights." << std::endl;
+        return false;
     }
 
     // Area lights
     try {
         auto areaLights = sceneConfig["areaLights"];
         for (auto l : areaLights)
-            this->lights.push_back(Light(LightType::AREA_LIGHT, l));
+            lights.push_back(Light(LightType::AREA_LIGHT, l));
     }
     catch (nlohmann::json::exception e) {
-        std::cerr << "No area lights defined." << std::endl;
+        std::cerr << "Invalid area lights." << std::endl;
+        return false;
     }
 
+    this->lightHash = lightHash;
+    this->lights.swap(lights);
+    return true;
+}
+
+/**
+ * Loads the OBJ and PLY files of the "surface" list. With previous sources,
+ * files whose dependencies are unchanged keep their already built surfaces
+ * from previousSurfaces instead of being parsed again. If a file cannot be
+ * loaded, the sources and previousSurfaces are restored and the exception
+ * is rethrown.
+ *
+ * \return
+ * The number of reparsed files
+ */
+int Scene::parseSurfaces(nlohmann::json sceneConfig, std::vector<Surface>* previousSurfaces)
+{
+    TRACE_SCOPE("Load surfaces");
+    size_t previousListHash = this->surfaceListHash;
+    AABB previousBox = this->bbox;
+    this->surfaceListHash = sectionHash(sceneConfig, { "surface" });
+    std::vector<SurfaceSource> previousSources;
+    previousSources.swap(this->sources);
+    this->surfaces.clear();
+    this->surfaceIdxs.clear();
+    this->bbox = AABB();
+    int reparsed = 0;
+
     // Surface
     try {
         auto surfacePaths = sceneConfig["surface"];
 
-        uint32_t surfaceIdx = 0;
-        for (std::string surfacePath : surfacePaths) {
-            surfacePath = sceneDirectory + "/" + surfacePath;
+        // Reuse the surfaces of unchanged files, everything else is loaded below
+        std::vector<std::vector<Surface>> fileSurfaces(surfacePaths.size());
+        std::vector<std::vector<std::string>> fileDependencies(surfacePaths.size());
+        std::vector<SurfaceSource> fileSources(surfacePaths.size());
+        std::vector<int64_t> reusedFirst(surfacePaths.size(), -1);
+        for (size_t f = 0; f < surfacePaths.size(); f++) {
+            SurfaceSource& source = fileSources[f];
+            source.path = this->sceneDirectory + "/" + surfacePaths[f].get<std::string>();
+
+            uint32_t previousFirst = 0;
+            for (auto& previous : previousSources) {
+                if (previousSurfaces != nullptr && !previous.reused && previous.path == source.path && previous.unchanged()) {
+                    auto first = previousSurfaces->begin() + previousFirst;
+                    fileSurfaces[f].assign(std::make_move_iterator(first), std::make_move_iterator(first + previous.count));
+                    source.files = previous.files;
+                    previous.reused = true;
+                    reusedFirst[f] = previousFirst;
+                    break;
+                }
+                previousFirst += previous.count;
+            }
+        }
+
+        // Mesh files are parsed in parallel, and each one adds tasks for
+        // decoding its textures and building the BVHs of its shapes. A single
+        // file is parsed right here instead, so that the OBJ parser can split
+        // it across all threads.
+        TaskGroup tasks;
+        LoadTimes times;
+        std::vector<size_t> toLoad;
+        for (size_t f = 0; f < surfacePaths.size(); f++) {
+            if (fileSources[f].files.empty())
+                toLoad.push_back(f);
+        }
+        try {
+            for (size_t f : toLoad) {
+                auto load = [&, f]() {
+                    loadSurfaces(fileSources[f].path, /*isLight=*/false, /*idx=*/0, &fileDependencies[f], fileSurfaces[f], tasks, times);
+                };
+                if (toLoad.size() == 1)
+                    load();
+                else
+                    tasks.run(load);
+                reparsed++;
+            }
+            tasks.wait();
+        }
+        catch (...) {
+            // Hand the reused surfaces back and free the partly loaded ones
+            for (size_t f = 0; f < surfacePaths.size(); f++) {
+                for (size_t i = 0; i < fileSurfaces[f].size(); i++) {
+                    if (reusedFirst[f] >= 0)
+                        (*previousSurfaces)[reusedFirst[f] + i] = std::move(fileSurfaces[f][i]);
+                    else
+                        fileSurfaces[f][i].release();
+                }
+            }
+            for (auto& previous : previousSources)
+                previous.reused = false;
+            this->sources.swap(previousSources);
+            this->surfaceListHash = previousListHash;
+            this->bbox = previousBox;
+            throw;
+        }
 
-            auto surf = createSurfaces(surfacePath, /*isLight=*/false, /*idx=*/surfaceIdx);
-            this->surfaces.insert(this->surfaces.end(), surf.begin(), surf.end());
+        this->loadStats.meshFiles = reparsed;
+        this->loadStats.textures = times.numTextures;
+        this->loadStats.parseMs = times.parse / 1000.f;
+        this->loadStats.geometryMs = times.geometry / 1000.f;
+        this->loadStats.textureMs = times.textures / 1000.f;
+        this->loadStats.bvhMs = times.bvh / 1000.f;
+
+        size_t numSurfaces = 0;
+        for (auto& surf : fileSurfaces)
+            numSurfaces += surf.size();
+        this->surfaces.reserve(numSurfaces);
+        this->surfaceIdxs.reserve(numSurfaces);
+
+        uint32_t surfaceIdx = 0;
+        for (size_t f = 0; f < surfacePaths.size(); f++) {
+            SurfaceSource& source = fileSources[f];
+            std::vector<Surface>& surf = fileSurfaces[f];
+            for (auto& path : fileDependencies[f])
+                source.files.push_back(FileStamp::of(path));
+            source.count = uint32_t(surf.size());
+            this->sources.push_back(source);
 
             // Update scene AABB & surfaceIdxs (used for indirection in BVH)
             int c = 0;
             for (auto& s : surf) {
+                s.shapeIdx = surfaceIdx + c;
                 this->bbox.min = Vector3f(std::min(this->bbox.min.x, s.bbox.min.x),
                     std::min(this->bbox.min.y, s.bbox.min.y),
                     std::min(this->bbox.min.z, s.bbox.min.z));
@@ -127,25 +382,192 @@ void Scene::parse(std::string sceneDirectory, nlohmann::json sceneConfig)
                 c += 1;
             }
 
+            this->surfaces.insert(this->surfaces.end(), std::make_move_iterator(surf.begin()), std::make_move_iterator(surf.end()));
             surfaceIdx = surfaceIdx + surf.size();
         }
-
-        // Allocate memory for BVH based on max
-        this->nodes = (BVHNode*) malloc((2 * this->surfaceIdxs.size() - 1) * sizeof(BVHNode));
-        for (int i = 0; i < 2 * this->surfaceIdxs.size() - 1; i++) {
-            this->nodes[i] = BVHNode();
-        }
     }
     catch (nlohmann::json::exception e) {
         std::cout << "No surfaces defined." << std::endl;
     }
 
-    // Build the BVH
-    this->buildBVH();
+    // Free what the new scene no longer uses
+    if (previousSurfaces != nullptr) {
+        uint32_t previousFirst = 0;
+        for (auto& previous : previousSources) {
+            if (!previous.reused) {
+                for (uint32_t i = 0; i < previous.count; i++)
+                    (*previousSurfaces)[previousFirst + i].release();
+            }
+            previousFirst += previous.count;
+        }
+    }
+
+    return reparsed;
+}
+
+FileStamp FileStamp::of(std::string path)
+{
+    FileStamp stamp;
+    stamp.path = path;
+
+    struct stat info;
+    if (stat(path.c_str(), &info) == 0) {
+        stamp.size = info.st_size;
+#ifdef __linux__
+        stamp.mtime = info.st_mtim.tv_sec * 1000000000ll + info.st_mtim.tv_nsec;
+#else
+        stamp.mtime = info.st_mtime;
+#endif
+    }
+    return stamp;
+}
+
+// 64-bit FNV-1a
+static void hashBytes(uint64_t& hash, const void* data, size_t size)
+{
+    const unsigned char* bytes = (const unsigned char*)data;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+}
+
+uint64_t Scene::contentHash()
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    size_t sections[3] = { this->cameraHash, this->lightHash, this->surfaceListHash };
+    hashBytes(hash, sections, sizeof(sections));
+    for (auto& source : this->sources) {
+        for (auto& file : source.files) {
+            hashBytes(hash, file.path.data(), file.path.size());
+            hashBytes(hash, &file.size, sizeof(file.size));
+            hashBytes(hash, &file.mtime, sizeof(file.mtime));
+        }
+    }
+    return hash;
+}
+
+bool SurfaceSource::unchanged()
+{
+    for (auto& file : this->files) {
+        FileStamp now = FileStamp::of(file.path);
+        if (now.size != file.size || now.mtime != file.mtime)
+            return false;
+    }
+    return true;
+}
+
+/**
+ * Brings the scene up to date with its config file and the files it
+ * references. Camera and light sections are reparsed only if their JSON
+ * changed, and only OBJ files whose OBJ, MTL or texture files changed are
+ * reloaded. If every file still yields the same number of surfaces the
+ * top-level BVH keeps its structure and is refit, otherwise it is rebuilt.
+ */
+ReloadStats Scene::reload()
+{
+    TRACE_SCOPE("Reload scene", this->configPath);
+    ReloadStats stats;
+    if (this->configPath.empty())
+        return stats;
+
+    nlohmann::json sceneConfig;
+    try {
+        std::ifstream sceneStream(this->configPath.c_str());
+        sceneStream >> sceneConfig;
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Could not load scene .json file, keeping the previous scene." << std::endl;
+        return stats;
+    }
+
+    // An invalid section keeps its previous state, and is parsed again on the next reload
+    if (sectionHash(sceneConfig, cameraSections) != this->cameraHash)
+        stats.cameras = this->parseCameras(sceneConfig);
+    if (sectionHash(sceneConfig, lightSections) != this->lightHash)
+        stats.lights = this->parseLights(sceneConfig);
+
+    // Geometry is untouched unless the surface list or one of its files changed
+    size_t listHash = sectionHash(sceneConfig, { "surface" });
+    bool surfacesChanged = listHash != this->surfaceListHash;
+    for (auto& source : this->sources)
+        surfacesChanged = surfacesChanged || !source.unchanged();
+    if (!surfacesChanged)
+        return stats;
+
+    std::vector<uint32_t> previousCounts;
+    for (auto& source : this->sources)
+        previousCounts.push_back(source.count);
+
+    std::vector<Surface> previousSurfaces;
+    previousSurfaces.swap(this->surfaces);
+    // The leaves of the BVH index this order of the surfaces
+    std::vector<uint32_t> previousIdxs;
+    previousIdxs.swap(this->surfaceIdxs);
+    try {
+        stats.reparsedFiles = this->parseSurfaces(sceneConfig, &previousSurfaces);
+    }
+    catch (const std::exception& e) {
+        // The files are loaded again on the next reload
+        std::cerr << e.what() << std::endl << "Keeping the previous surfaces." << std::endl;
+        this->surfaces.swap(previousSurfaces);
+        this->surfaceIdxs.swap(previousIdxs);
+        return stats;
+    }
+    stats.keptFiles = int(this->sources.size()) - stats.reparsedFiles;
+
+    std::vector<uint32_t> counts;
+    for (auto& source : this->sources)
+        counts.push_back(source.count);
+
+    if (counts == previousCounts && this->nodes != nullptr) {
+        // Surface i is still the i-th shape of the same file
+        this->surfaceIdxs.swap(previousIdxs);
+        this->refitBVH();
+        stats.bvhRefit = true;
+    }
+    else {
+        this->buildBVH();
+        stats.bvhRebuilt = true;
+    }
+    return stats;
+}
+
+void Scene::refitBVH()
+{
+    // Children are always stored after their parent
+    for (int i = this->numBVHNodes - 1; i >= 0; i--) {
+        BVHNode& node = this->nodes[i];
+        if (node.primCount != 0) {
+            node.bbox = AABB();
+            this->updateNodeBounds(i);
+        }
+        else {
+            AABB& l = this->nodes[node.left].bbox;
+            AABB& r = this->nodes[node.right].bbox;
+            node.bbox.min = Vector3f(std::min(l.min.x, r.min.x), std::min(l.min.y, r.min.y), std::min(l.min.z, r.min.z));
+            node.bbox.max = Vector3f(std::max(l.max.x, r.max.x), std::max(l.max.y, r.max.y), std::max(l.max.z, r.max.z));
+            node.bbox.centroid = (node.bbox.min + node.bbox.max) / 2.f;
+        }
+    }
 }
 
 void Scene::buildBVH()
 {
+    TRACE_SCOPE("Build scene BVH");
+    auto startTime = std::chrono::high_resolution_clock::now();
+    // Allocate memory for BVH based on max
+    trackedFree(MEM_BVH, this->nodes);
+    this->nodes = nullptr;
+    this->numBVHNodes = 0;
+    if (this->surfaceIdxs.empty())
+        return;
+
+    this->nodes = (BVHNode*)trackedMalloc(MEM_BVH, (2 * this->surfaceIdxs.size() - 1) * sizeof(BVHNode));
+    for (int i = 0; i < 2 * this->surfaceIdxs.size() - 1; i++) {
+        this->nodes[i] = BVHNode();
+    }
+
     // Root node
     this->numBVHNodes += 1;
 
@@ -155,6 +577,8 @@ void Scene::buildBVH()
 
     this->updateNodeBounds(0);
     this->subdivideNode(0);
+    this->bvhBuildMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+    this->loadStats.topLevelBvhMs = this->bvhBuildMs;
 }
 
 uint32_t Scene::getIdx(uint32_t idx)
@@ -167,7 +591,7 @@ void Scene::updateNodeBounds(uint32_t nodeIdx)
     BVHNode& node = this->nodes[nodeIdx];
 
     for (int i = 0; i < node.primCount; i++) {
-        auto surf = this->surfaces[this->getIdx(i + node.firstPrim)];
+        const Surface& surf = this->surfaces[this->getIdx(i + node.firstPrim)];
         node.bbox.min = Vector3f(
             std::min(node.bbox.min.x, surf.bbox.min.x),
             std::min(node.bbox.min.y, surf.bbox.min.y),
@@ -237,7 +661,9 @@ void Scene::intersectBVH(uint32_t nodeIdx, Ray &ray, Interaction& si)
 {
     BVHNode& node = this->nodes[nodeIdx];
 
+    STAT_INC(STAT_AABB_TESTS);
     if (!node.bbox.intersects(ray)) return;
+    STAT_INC(STAT_BVH_NODES);
 
     if (node.primCount != 0) {
         // Leaf
@@ -260,7 +686,13 @@ Interaction Scene::rayIntersect(Ray& ray)
     Interaction si;
     si.didIntersect = false;
 
-    this->intersectBVH(0, ray, si);
+    if (this->nodes != nullptr)
+        this->intersectBVH(0, ray, si);
+
+    if (si.didIntersect)
+        STAT_INC(STAT_HITS);
+    else
+        STAT_INC(STAT_MISSES);
 
     return si;
 }
@@ -282,4 +714,29 @@ Interaction Scene::rayEmitterIntersect(Ray& ray) {
     }
 
     return si;
-}
\ No newline at end of file
+}
+
+size_t Scene::memoryUsage()
+{
+    size_t bytes = sizeof(Scene)
+        + this->surfaces.capacity() * sizeof(Surface)
+        + this->surfaceIdxs.capacity() * sizeof(uint32_t)
+        + this->lights.capacity() * sizeof(Light)
+        + (this->surfaceIdxs.empty() ? 0 : 2 * this->surfaceIdxs.size() - 1) * sizeof(BVHNode);
+
+    for (auto& surf : this->surfaces)
+        bytes += surf.memoryUsage();
+
+    return bytes;
+}
+
+/**
+ * Frees the BVH nodes and textures owned by the scene and its surfaces.
+ */
+void Scene::release()
+{
+    for (auto& surf : this->surfaces)
+        surf.release();
+    trackedFree(MEM_BVH, this->nodes);
+    this->nodes = nullptr;
+}
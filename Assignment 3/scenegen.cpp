@@ -0,0 +1,275 @@
+#include "texture.h"
+
+#include <sys/stat.h>
+
+/**
+ * Procedural test scenes for benchmarking. Every scene is a Cornell style
+ * room ([-1, 1] x [0, 2] x [-1, 1], open at the front) with generated
+ * content, written as config.json, scene.obj and scene.mtl (plus textures)
+ * into the output directory. The content only depends on the seed.
+ */
+
+struct ObjWriter {
+    std::ofstream obj;
+    std::ofstream mtl;
+    std::string directory;
+    int numVertices = 0, numNormals = 0, numTriangles = 0;
+
+    ObjWriter(std::string directory)
+        : obj((directory + "/scene.obj").c_str()),
+        mtl((directory + "/scene.mtl").c_str()),
+        directory(directory)
+    {
+        this->obj << "mtllib scene.mtl\n";
+        this->obj << "vt 0 0\nvt 1 0\nvt 1 1\nvt 0 1\n";
+    }
+
+    void material(std::string name, Vector3f diffuse, std::string texture = "")
+    {
+        this->mtl << "newmtl " << name << "\nKd " << diffuse.x << " " << diffuse.y << " " << diffuse.z << "\nKs 1 1 1\n";
+        if (!texture.empty())
+            this->mtl << "map_Kd " << texture << "\n";
+    }
+
+    // Every object becomes one surface with a single material
+    void object(std::string name, std::string material)
+    {
+        this->obj << "o " << name << "\nusemtl " << material << "\n";
+    }
+
+    void triangle(Vector3f a, Vector3f b, Vector3f c)
+    {
+        Vector3f n = Normalize(Cross(b - a, c - a));
+        this->obj << "v " << a.x << " " << a.y << " " << a.z << "\n"
+            << "v " << b.x << " " << b.y << " " << b.z << "\n"
+            << "v " << c.x << " " << c.y << " " << c.z << "\n"
+            << "vn " << n.x << " " << n.y << " " << n.z << "\n";
+        int v = this->numVertices, vn = ++this->numNormals;
+        this->obj << "f " << v + 1 << "/1/" << vn << " " << v + 2 << "/2/" << vn << " " << v + 3 << "/3/" << vn << "\n";
+        this->numVertices += 3;
+        this->numTriangles++;
+    }
+
+    // Quad a, b, c, d counter-clockwise as seen from the side it faces, uvs span [0, 1]^2
+    void quad(Vector3f a, Vector3f b, Vector3f c, Vector3f d)
+    {
+        Vector3f n = Normalize(Cross(b - a, c - a));
+        this->obj << "v " << a.x << " " << a.y << " " << a.z << "\n"
+            << "v " << b.x << " " << b.y << " " << b.z << "\n"
+            << "v " << c.x << " " << c.y << " " << c.z << "\n"
+            << "v " << d.x << " " << d.y << " " << d.z << "\n"
+            << "vn " << n.x << " " << n.y << " " << n.z << "\n";
+        int v = this->numVertices, vn = ++this->numNormals;
+        this->obj << "f " << v + 1 << "/1/" << vn << " " << v + 2 << "/2/" << vn << " " << v + 3 << "/3/" << vn << "\n"
+            << "f " << v + 1 << "/1/" << vn << " " << v + 3 << "/3/" << vn << " " << v + 4 << "/4/" << vn << "\n";
+        this->numVertices += 4;
+        this->numTriangles += 2;
+    }
+
+    // Axis aligned box with outward faces
+    void box(Vector3f lower, Vector3f upper)
+    {
+        Vector3f l = lower, u = upper;
+        this->quad(Vector3f(l.x, l.y, u.z), Vector3f(u.x, l.y, u.z), Vector3f(u.x, u.y, u.z), Vector3f(l.x, u.y, u.z));
+        this->quad(Vector3f(u.x, l.y, l.z), Vector3f(l.x, l.y, l.z), Vector3f(l.x, u.y, l.z), Vector3f(u.x, u.y, l.z));
+        this->quad(Vector3f(l.x, l.y, l.z), Vector3f(l.x, l.y, u.z), Vector3f(l.x, u.y, u.z), Vector3f(l.x, u.y, l.z));
+        this->quad(Vector3f(u.x, l.y, u.z), Vector3f(u.x, l.y, l.z), Vector3f(u.x, u.y, l.z), Vector3f(u.x, u.y, u.z));
+        this->quad(Vector3f(l.x, u.y, u.z), Vector3f(u.x, u.y, u.z), Vector3f(u.x, u.y, l.z), Vector3f(l.x, u.y, l.z));
+        this->quad(Vector3f(l.x, l.y, l.z), Vector3f(u.x, l.y, l.z), Vector3f(u.x, l.y, u.z), Vector3f(l.x, l.y, u.z));
+    }
+
+    void sphere(Vector3f center, float radius, int rings, int segments)
+    {
+        auto point = [&](int ring, int segment) {
+            float theta = M_PI * ring / rings, phi = 2.f * M_PI * segment / segments;
+            return center + radius * Vector3f(std::sin(theta) * std::cos(phi), std::cos(theta), -std::sin(theta) * std::sin(phi));
+        };
+        for (int r = 0; r < rings; r++) {
+            for (int s = 0; s < segments; s++) {
+                Vector3f a = point(r, s), b = point(r + 1, s), c = point(r + 1, s + 1), d = point(r, s + 1);
+                if (r != 0)
+                    this->triangle(a, b, c);
+                if (r != rings - 1)
+                    this->triangle(a, c, d);
+            }
+        }
+    }
+
+    // Floor, ceiling, back, red left and green right wall, all facing inwards
+    void room()
+    {
+        this->material("white", Vector3f(0.8f, 0.8f, 0.8f));
+        this->material("red", Vector3f(0.8f, 0.1f, 0.1f));
+        this->material("green", Vector3f(0.1f, 0.8f, 0.1f));
+
+        this->object("floor", "white");
+        this->quad(Vector3f(-1, 0, 1), Vector3f(1, 0, 1), Vector3f(1, 0, -1), Vector3f(-1, 0, -1));
+        this->object("ceiling", "white");
+        this->quad(Vector3f(-1, 2, -1), Vector3f(1, 2, -1), Vector3f(1, 2, 1), Vector3f(-1, 2, 1));
+        this->object("back", "white");
+        this->quad(Vector3f(-1, 0, -1), Vector3f(1, 0, -1), Vector3f(1, 2, -1), Vector3f(-1, 2, -1));
+        this->object("left", "red");
+        this->quad(Vector3f(-1, 0, 1), Vector3f(-1, 0, -1), Vector3f(-1, 2, -1), Vector3f(-1, 2, 1));
+        this->object("right", "green");
+        this->quad(Vector3f(1, 0, -1), Vector3f(1, 0, 1), Vector3f(1, 2, 1), Vector3f(1, 2, -1));
+    }
+};
+
+static nlohmann::json areaLight(Vector3f center, float halfSize, float radiance)
+{
+    return {
+        { "center", { center.x, center.y, center.z } },
+        { "vx", { halfSize, 0, 0 } },
+        { "vy", { 0, 0, halfSize } },
+        { "normal", { 0, -1, 0 } },
+        { "radiance", { radiance, radiance, radiance } }
+    };
+}
+
+static Vector3f randomPoint(Vector3f lower, Vector3f upper)
+{
+    return Vector3f(
+        lower.x + (upper.x - lower.x) * next_float(),
+        lower.y + (upper.y - lower.y) * next_float(),
+        lower.z + (upper.z - lower.z) * next_float());
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3) {
+        std::cerr << "Usage: ./scenegen <type> <out_dir> [size] [--seed <n>] [--resolution <w> <h>]\n"
+                  << "Types:\n"
+                  << "  cornell             Cornell box with two boxes and an area light\n"
+                  << "  soup <triangles>    Random triangles in the room, 1024 per surface\n"
+                  << "  grid <n>            n^3 spheres of 480 triangles each\n"
+                  << "  lights <m>          Two boxes lit by m area lights\n"
+                  << "  textured <k>        Floor split into k tiles with their own 256x256 texture\n";
+        return 1;
+    }
+
+    std::string type = argv[1], dir = argv[2];
+    int size = 0;
+    uint64_t seed = 0;
+    Vector2i resolution(256, 192);
+    for (int i = 3; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--seed" && i + 1 < argc)
+            seed = strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--resolution" && i + 2 < argc) {
+            resolution.x = atoi(argv[++i]);
+            resolution.y = atoi(argv[++i]);
+        }
+        else
+            size = atoi(argv[i]);
+    }
+
+#ifdef _WIN32
+    _mkdir(dir.c_str());
+#else
+    mkdir(dir.c_str(), 0755);
+#endif
+
+    seed_random(seed, 0, 0);
+    ObjWriter writer(dir);
+    if (!writer.obj || !writer.mtl) {
+        std::cerr << "Could not write to " << dir << std::endl;
+        return 1;
+    }
+    writer.room();
+
+    nlohmann::json config;
+    config["output"]["resolution"] = { resolution.x, resolution.y };
+    config["camera"] = {
+        { "from", { 0, 1, 3.5 } },
+        { "to", { 0, 1, 0 } },
+        { "up", { 0, 1, 0 } },
+        { "fieldOfView", 45 }
+    };
+    config["surface"] = { "scene.obj" };
+    config["areaLights"] = nlohmann::json::array();
+
+    if (type == "cornell") {
+        writer.object("box1", "white");
+        writer.box(Vector3f(-0.6f, 0.f, -0.5f), Vector3f(-0.1f, 1.2f, 0.f));
+        writer.object("box2", "white");
+        writer.box(Vector3f(0.1f, 0.f, -0.1f), Vector3f(0.6f, 0.5f, 0.4f));
+        config["areaLights"].push_back(areaLight(Vector3f(0.f, 1.99f, 0.f), 0.3f, 8.f));
+    }
+    else if (type == "soup") {
+        size = std::max(size, 1);
+        for (int t = 0; t < size; t++) {
+            if (t % 1024 == 0)
+                writer.object("soup" + std::to_string(t / 1024), "white");
+            Vector3f center = randomPoint(Vector3f(-0.9f, 0.1f, -0.9f), Vector3f(0.9f, 1.8f, 0.9f));
+            float edge = 0.1f;
+            writer.triangle(center + randomPoint(Vector3f(-edge), Vector3f(edge)),
+                center + randomPoint(Vector3f(-edge), Vector3f(edge)),
+                center + randomPoint(Vector3f(-edge), Vector3f(edge)));
+        }
+        config["areaLights"].push_back(areaLight(Vector3f(0.f, 1.99f, 0.f), 0.3f, 8.f));
+    }
+    else if (type == "grid") {
+        size = std::max(size, 1);
+        float spacing = 1.6f / size;
+        for (int z = 0; z < size; z++) {
+            for (int y = 0; y < size; y++) {
+                for (int x = 0; x < size; x++) {
+                    writer.object("sphere" + std::to_string((z * size + y) * size + x), "white");
+                    Vector3f center = Vector3f(-0.8f, 0.2f, -0.8f) + spacing * Vector3f(x + 0.5f, y + 0.5f, z + 0.5f);
+                    writer.sphere(center, 0.4f * spacing, 16, 16);
+                }
+            }
+        }
+        config["areaLights"].push_back(areaLight(Vector3f(0.f, 1.99f, 0.f), 0.3f, 8.f));
+    }
+    else if (type == "lights") {
+        size = std::max(size, 1);
+        writer.object("box1", "white");
+        writer.box(Vector3f(-0.6f, 0.f, -0.5f), Vector3f(-0.1f, 1.2f, 0.f));
+        writer.object("box2", "white");
+        writer.box(Vector3f(0.1f, 0.f, -0.1f), Vector3f(0.6f, 0.5f, 0.4f));
+
+        // Lights on a grid below the ceiling with the total power of one light
+        int perRow = int(std::ceil(std::sqrt(float(size))));
+        float halfSize = 0.6f / perRow;
+        for (int l = 0; l < size; l++) {
+            float x = -0.8f + 1.6f * (l % perRow + 0.5f) / perRow;
+            float z = -0.8f + 1.6f * (l / perRow + 0.5f) / perRow;
+            config["areaLights"].push_back(areaLight(Vector3f(x, 1.99f, z), halfSize, 8.f * 0.09f / (halfSize * halfSize * size)));
+        }
+    }
+    else if (type == "textured") {
+        size = std::max(size, 1);
+        int perRow = int(std::ceil(std::sqrt(float(size))));
+        float tile = 2.f / perRow;
+        for (int k = 0; k < size; k++) {
+            // Checkerboard with a color per tile
+            Vector3f color(0.2f + 0.6f * next_float(), 0.2f + 0.6f * next_float(), 0.2f + 0.6f * next_float());
+            Texture texture;
+            texture.allocate(TextureType::UNSIGNED_INTEGER_ALPHA, Vector2i(256, 256));
+            for (int y = 0; y < 256; y++)
+                for (int x = 0; x < 256; x++)
+                    texture.writePixelColor(((x / 32 + y / 32) % 2) ? color : Vector3f(0.9f), x, y);
+            std::string name = "texture" + std::to_string(k) + ".png";
+            texture.savePng(dir + "/" + name);
+            texture.release();
+
+            writer.material("tile" + std::to_string(k), Vector3f(1.f), name);
+            writer.object("tile" + std::to_string(k), "tile" + std::to_string(k));
+            float x = -1.f + tile * (k % perRow), z = 1.f - tile * (k / perRow);
+            writer.quad(Vector3f(x, 0.001f, z), Vector3f(x + tile, 0.001f, z), Vector3f(x + tile, 0.001f, z - tile), Vector3f(x, 0.001f, z - tile));
+        }
+        config["areaLights"].push_back(areaLight(Vector3f(0.f, 1.99f, 0.f), 0.3f, 8.f));
+    }
+    else {
+        std::cerr << "Unknown scene type " << type << std::endl;
+        return 1;
+    }
+
+    std::ofstream configFile((dir + "/config.json").c_str());
+    configFile << config.dump(1) << std::endl;
+
+    std::cout << "Wrote " << dir << "/config.json: " << writer.numTriangles << " triangles, "
+        << config["areaLights"].size() << " area lights" << std::endl;
+    return 0;
+}
@@ -0,0 +1,45 @@
+#!/bin/bash
+# Generates the procedural benchmark scenes, renders each one in a fresh process
+# and writes the --bench-report lines of all renders as one JSON array.
+# Usage: scripts/benchmark_suite.sh <build_dir> <output.json> [num_samples] [sampling_strategies] [seed]
+# Extra render options can be passed in RENDER_OPTIONS, e.g. RENDER_OPTIONS="--perf".
+
+if [ $# -lt 2 ]; then
+    echo "Usage: $0 <build_dir> <output.json> [num_samples] [sampling_strategies] [seed]"
+    exit 1
+fi
+
+BUILD=$1
+OUTPUT=$2
+SPP=${3:-16}
+STRATEGIES=${4:-"1 2"}
+SEED=${5:-1}
+
+# <name> <scene type> [size]
+SCENES=(
+    "cornell cornell"
+    "soup_10k soup 10000"
+    "soup_100k soup 100000"
+    "grid_4 grid 4"
+    "grid_8 grid 8"
+    "lights_16 lights 16"
+    "lights_64 lights 64"
+    "textured_16 textured 16"
+)
+
+WORKDIR=$(mktemp -d)
+REPORT=$WORKDIR/report.jsonl
+
+for entry in "${SCENES[@]}"; do
+    read -r NAME TYPE SIZE <<< "$entry"
+    "$BUILD/scenegen" "$TYPE" "$WORKDIR/$NAME" $SIZE --seed "$SEED" > /dev/null || exit 1
+    for strategy in $STRATEGIES; do
+        echo "$NAME, strategy $strategy" >&2
+        "$BUILD/render" "$WORKDIR/$NAME/config.json" "$WORKDIR/$NAME/out_$strategy.png" "$SPP" "$strategy" \
+            --seed "$SEED" --bench-report "$REPORT" $RENDER_OPTIONS > /dev/null || exit 1
+    done
+done
+
+awk 'BEGIN { print "[" } { printf "%s%s", (NR > 1 ? ",\n" : ""), $0 } END { print "\n]" }' "$REPORT" > "$OUTPUT"
+
+rm -rf "$WORKDIR"
@@ -0,0 +1,37 @@
+#!/bin/bash
+# Renders a scene with 1..N local worker processes and prints a scaling table.
+# Usage: scripts/scaling_report.sh <render_binary> <scene_config> <num_samples> <sampling_strategy> <max_workers> [threads_per_worker]
+
+if [ $# -lt 5 ]; then
+    echo "Usage: $0 <render_binary> <scene_config> <num_samples> <sampling_strategy> <max_workers> [threads_per_worker]"
+    exit 1
+fi
+
+RENDER=$1
+SCENE=$2
+SPP=$3
+STRATEGY=$4
+MAX_WORKERS=$5
+THREADS=${6:-1}
+
+WORKDIR=$(mktemp -d)
+REPORT=$WORKDIR/report.jsonl
+
+for ((n = 1; n <= MAX_WORKERS; n++)); do
+    "$RENDER" "$SCENE" "$WORKDIR/out_$n.exr" "$SPP" "$STRATEGY" \
+        --coordinator "unix:$WORKDIR/coordinator.sock" --spawn "$n" --threads "$((n * THREADS))" \
+        --report "$REPORT" > /dev/null || exit 1
+done
+
+echo "workers,render_ms,speedup,efficiency,reissued_leases"
+awk -F'[:,}]' '{
+    for (i = 1; i < NF; i++) {
+        if ($i ~ /"renderMs"/) ms = $(i + 1);
+        if ($i ~ /"reissuedLeases"/) reissued = $(i + 1);
+        if ($i ~ /"spawnedWorkers"/) workers = $(i + 1);
+    }
+    if (NR == 1) base = ms;
+    printf "%d,%.1f,%.2f,%.2f,%d\n", workers, ms, base / ms, base / ms / workers, reissued;
+}' "$REPORT"
+
+rm -rf "$WORKDIR"
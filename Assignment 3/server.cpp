@@ -0,0 +1,265 @@
+#include "server.h"
+#include "net.h"
+
+#include <algorithm>
+
+SceneCache::~SceneCache()
+{
+    for (auto& entry : this->entries)
+        entry.scene->release();
+}
+
+Scene* SceneCache::get(std::string path, bool& hit, ReloadStats& stats, std::string& error)
+{
+    for (auto it = this->entries.begin(); it != this->entries.end(); ++it) {
+        if (it->path == path) {
+            // Move to the front
+            this->entries.splice(this->entries.begin(), this->entries, it);
+            hit = true;
+
+            // Pick up edits to the scene files since the last request
+            Entry& entry = this->entries.front();
+            stats = entry.scene->reload();
+            if (stats.reparsedFiles > 0) {
+                this->totalBytes -= entry.bytes;
+                entry.bytes = entry.scene->memoryUsage();
+                this->totalBytes += entry.bytes;
+                this->evict();
+            }
+            return entry.scene.get();
+        }
+    }
+
+    hit = false;
+    if (!std::ifstream(path.c_str()).good()) {
+        std::cerr << "Scene " << path << " does not exist." << std::endl;
+        error = "scene does not exist";
+        return nullptr;
+    }
+
+    Entry entry;
+    entry.path = path;
+    try {
+        entry.scene.reset(new Scene(path));
+    }
+    catch (const std::exception& e) {
+        // Only this request fails, the cached scenes stay warm
+        std::cerr << "Could not load scene " << path << ": " << e.what() << std::endl;
+        error = e.what();
+        return nullptr;
+    }
+    entry.bytes = entry.scene->memoryUsage();
+    this->totalBytes += entry.bytes;
+    this->entries.push_front(std::move(entry));
+
+    this->evict();
+    return this->entries.front().scene.get();
+}
+
+void SceneCache::evict()
+{
+    while (this->totalBytes > this->budget && this->entries.size() > 1) {
+        Entry& entry = this->entries.back();
+        std::cout << "Evicting " << entry.path << " (" << entry.bytes / (1024 * 1024) << " MB)" << std::endl;
+        this->totalBytes -= entry.bytes;
+        entry.scene->release();
+        this->entries.pop_back();
+    }
+}
+
+nlohmann::json RenderServer::handle(nlohmann::json request, Framebuffer& image)
+{
+    nlohmann::json reply;
+    auto startTime = std::chrono::high_resolution_clock::now();
+
+    bool hit;
+    ReloadStats stats;
+    std::string error;
+    Scene* scene = this->cache.get(request.value("scene", std::string()), hit, stats, error);
+    if (scene == nullptr) {
+        reply["error"] = "could not load scene: " + error;
+        return reply;
+    }
+    auto loadedTime = std::chrono::high_resolution_clock::now();
+
+    Integrator integrator(*scene);
+    integrator.spp = request.value("spp", 16);
+    integrator.seed = request.value("seed", 0ull);
+    variant = request.value("variant", 2);
+
+    Vector2i res = scene->imageResolution;
+    if (request.count("resolution"))
+        res = Vector2i(request["resolution"][0], request["resolution"][1]);
+
+    integrator.camera = scene->camera.modified(request.value("camera", nlohmann::json::object()), res);
+
+    int x0 = 0, y0 = 0, x1 = res.x, y1 = res.y;
+    if (request.count("crop")) {
+        x0 = std::max(0, int(request["crop"][0]));
+        y0 = std::max(0, int(request["crop"][1]));
+        x1 = std::min(res.x, int(request["crop"][2]));
+        y1 = std::min(res.y, int(request["crop"][3]));
+    }
+    if (x1 <= x0 || y1 <= y0) {
+        reply["error"] = "empty crop window";
+        return reply;
+    }
+
+    image.allocate(Vector2i(x1 - x0, y1 - y0));
+    integrator.renderTile(image, Vector2i(x0, y0));
+    auto finishTime = std::chrono::high_resolution_clock::now();
+
+    reply["width"] = x1 - x0;
+    reply["height"] = y1 - y0;
+    reply["crop"] = { x0, y0, x1, y1 };
+    reply["cacheHit"] = hit;
+    if (stats.changed()) {
+        reply["reload"] = {
+            { "cameras", stats.cameras },
+            { "lights", stats.lights },
+            { "reparsedFiles", stats.reparsedFiles },
+            { "keptFiles", stats.keptFiles },
+            { "bvh", stats.bvhRebuilt ? "rebuilt" : (stats.bvhRefit ? "refit" : "unchanged") }
+        };
+    }
+    reply["cachedScenes"] = this->cache.entries.size();
+    reply["cacheBytes"] = this->cache.totalBytes;
+    reply["loadMs"] = std::chrono::duration<double, std::milli>(loadedTime - startTime).count();
+    reply["renderMs"] = std::chrono::duration<double, std::milli>(finishTime - loadedTime).count();
+    return reply;
+}
+
+int RenderServer::run()
+{
+    // Clients can name any file to load and render, so only local ones may connect
+    int listenFd = listenSocket(this->address, /*loopbackOnly=*/true);
+    if (listenFd < 0)
+        return 1;
+    std::cout << "Render server listening on " << this->address << std::endl;
+
+    bool running = true;
+    std::vector<char> payload;
+
+    // One client at a time; each request uses all render threads
+    while (running) {
+        int fd = acceptSocket(listenFd);
+        if (fd < 0)
+            continue;
+
+        uint32_t type;
+        while (running && recvMessage(fd, type, payload) && type == MSG_RENDER_REQUEST) {
+            nlohmann::json request, reply;
+            try {
+                request = nlohmann::json::parse(std::string(payload.begin(), payload.end()));
+            }
+            catch (nlohmann::json::exception e) {
+                reply["error"] = "could not parse request";
+            }
+
+            Framebuffer image;
+            std::string command = request.is_object() ? request.value("command", std::string()) : std::string();
+            if (!reply.count("error")) {
+                if (command == "shutdown") {
+                    reply["shutdown"] = true;
+                    running = false;
+                }
+                else if (command == "stats") {
+                    reply["cachedScenes"] = this->cache.entries.size();
+                    reply["cacheBytes"] = this->cache.totalBytes;
+                    reply["cacheBudget"] = this->cache.budget;
+                }
+                else {
+                    try {
+                        reply = this->handle(request, image);
+                    }
+                    catch (nlohmann::json::exception e) {
+                        reply["error"] = std::string("invalid request: ") + e.what();
+                    }
+                    catch (const std::exception& e) {
+                        reply["error"] = std::string("request failed: ") + e.what();
+                    }
+                }
+            }
+
+            // Pixel means as float RGB, empty when there is no image
+            std::vector<float> pixels(image.color.size());
+            for (size_t p = 0; p < image.sampleCount.size(); p++) {
+                Vector3f m = image.mean(int(p));
+                pixels[3 * p + 0] = m.x;
+                pixels[3 * p + 1] = m.y;
+                pixels[3 * p + 2] = m.z;
+            }
+
+            if (!sendMessage(fd, MSG_RENDER_REPLY, reply.dump())
+                || !sendMessage(fd, MSG_RENDER_IMAGE, pixels.data(), pixels.size() * sizeof(float)))
+                break;
+        }
+        closeSocket(fd);
+    }
+
+    closeSocket(listenFd);
+    return 0;
+}
+
+int runClient(std::string address, std::string requestPath, std::string outPath, int repeat)
+{
+    std::ifstream requestStream(requestPath.c_str());
+    std::string request((std::istreambuf_iterator<char>(requestStream)), std::istreambuf_iterator<char>());
+    if (request.empty()) {
+        std::cerr << "Could not read request " << requestPath << std::endl;
+        return 1;
+    }
+
+    int fd = connectSocket(address);
+    if (fd < 0) {
+        std::cerr << "Could not connect to " << address << std::endl;
+        return 1;
+    }
+
+    std::vector<double> latencies;
+    nlohmann::json reply;
+    std::vector<char> payload, pixels;
+
+    for (int i = 0; i < std::max(repeat, 1); i++) {
+        auto startTime = std::chrono::high_resolution_clock::now();
+        uint32_t type;
+        if (!sendMessage(fd, MSG_RENDER_REQUEST, request) || !recvMessage(fd, type, payload)
+            || type != MSG_RENDER_REPLY || !recvMessage(fd, type, pixels)) {
+            std::cerr << "Lost connection to the server" << std::endl;
+            closeSocket(fd);
+            return 1;
+        }
+        auto finishTime = std::chrono::high_resolution_clock::now();
+        latencies.push_back(std::chrono::duration<double, std::milli>(finishTime - startTime).count());
+
+        reply = nlohmann::json::parse(std::string(payload.begin(), payload.end()));
+        if (reply.count("error")) {
+            std::cerr << "Server error: " << reply["error"].get<std::string>() << std::endl;
+            closeSocket(fd);
+            return 1;
+        }
+    }
+    closeSocket(fd);
+
+    std::cout << "Last reply: " << reply.dump() << std::endl;
+    std::cout << "First request: " << latencies[0] << " ms" << std::endl;
+
+    // The first request may have loaded the scene, percentiles are over the rest
+    std::vector<double> warm(latencies.begin() + 1, latencies.end());
+    if (!warm.empty()) {
+        std::sort(warm.begin(), warm.end());
+        auto percentile = [&](double q) { return warm[std::min(warm.size() - 1, size_t(q * warm.size()))]; };
+        std::cout << "Warm requests: " << warm.size() << ", p50 " << percentile(0.5) << " ms, p90 "
+            << percentile(0.9) << " ms, p99 " << percentile(0.99) << " ms, max " << warm.back() << " ms" << std::endl;
+    }
+
+    if (!outPath.empty() && reply.count("width")) {
+        Framebuffer image;
+        image.allocate(Vector2i(reply["width"], reply["height"]));
+        std::memcpy(image.color.data(), pixels.data(), std::min(pixels.size(), image.color.size() * sizeof(float)));
+        std::fill(image.sampleCount.begin(), image.sampleCount.end(), 1);
+        image.save(outPath);
+    }
+
+    return 0;
+}
@@ -0,0 +1,67 @@
+#include "stats.h"
+
+#include <fstream>
+#include <iostream>
+#include <mutex>
+
+#include "json/include/nlohmann/json.hpp"
+
+static const char* counterNames[NUM_STAT_COUNTERS] = {
+    "cameraRays", "shadowRays", "secondaryRays", "bvhNodesVisited",
+    "aabbTests", "triangleTests", "hits", "misses"
+};
+
+static std::mutex totalsMutex;
+static RenderStats totals;
+
+void RenderStats::add(const RenderStats& other)
+{
+    for (int c = 0; c < NUM_STAT_COUNTERS; c++)
+        this->counters[c] += other.counters[c];
+}
+
+#if RENDER_STATS
+ThreadStats::~ThreadStats()
+{
+    std::lock_guard<std::mutex> lock(totalsMutex);
+    totals.add(*this);
+}
+#endif
+
+RenderStats RenderStats::collect()
+{
+    std::lock_guard<std::mutex> lock(totalsMutex);
+    RenderStats result = totals;
+#if RENDER_STATS
+    result.add(threadStats());
+#endif
+    return result;
+}
+
+void RenderStats::reset()
+{
+    std::lock_guard<std::mutex> lock(totalsMutex);
+    totals = RenderStats();
+#if RENDER_STATS
+    static_cast<RenderStats&>(threadStats()) = RenderStats();
+#endif
+}
+
+bool RenderStats::writeJson(std::string path, double seconds)
+{
+    nlohmann::json out;
+    out["enabled"] = bool(RENDER_STATS);
+    out["seconds"] = seconds;
+    for (int c = 0; c < NUM_STAT_COUNTERS; c++)
+        out[counterNames[c]] = this->counters[c];
+    out["rays"] = this->rays();
+    out["raysPerSecond"] = seconds > 0.0 ? this->rays() / seconds : 0.0;
+
+    std::ofstream file(path.c_str());
+    if (!file) {
+        std::cerr << "Could not write statistics to " << path << std::endl;
+        return false;
+    }
+    file << out.dump(2) << std::endl;
+    return true;
+}
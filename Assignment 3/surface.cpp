@@ -1,165 +1,189 @@
 #include "bsdf.h"
+#include "obj.h"
+#include "ply.h"
 #include "surface.h"
+#include "parallel.h"
+#include "stats.h"
+#include "trace.h"
 
-#define TINYOBJLOADER_IMPLEMENTATION
-#include "tinyobjloader/tiny_obj_loader.h"
+#include <stdexcept>
+#include <unordered_map>
 
-std::vector<Surface> createSurfaces(std::string pathToObj, bool isLight, uint32_t shapeIdx)
+std::vector<Surface> createSurfaces(std::string pathToObj, bool isLight, uint32_t shapeIdx, std::vector<std::string>* dependencies)
 {
+    std::vector<Surface> surfaces;
+    TaskGroup tasks;
+    LoadTimes times;
+    loadSurfaces(pathToObj, isLight, shapeIdx, dependencies, surfaces, tasks, times);
+    tasks.wait();
+    return surfaces;
+}
+
+VertexEncoding vertexEncoding = VERTEX_FLOAT;
+
+// Position, normal and texcoord index of an OBJ face corner
+struct ObjCorner {
+    int vertex, normal, texcoord;
+
+    bool operator==(const ObjCorner& other) const
+    {
+        return this->vertex == other.vertex && this->normal == other.normal && this->texcoord == other.texcoord;
+    }
+};
+
+struct ObjCornerHash {
+    size_t operator()(const ObjCorner& corner) const
+    {
+        uint64_t h = uint64_t(uint32_t(corner.vertex)) * 0x9E3779B97F4A7C15ull;
+        h ^= (uint64_t(uint32_t(corner.normal)) + 0x632BE59BD9B4E019ull + (h << 6) + (h >> 2)) * 0xC2B2AE3D27D4EB4Full;
+        h ^= (uint64_t(uint32_t(corner.texcoord)) + 0x165667B19E3779F9ull + (h << 6) + (h >> 2)) * 0x94D049BB133111EBull;
+        return size_t(h ^ (h >> 31));
+    }
+};
+
+static long long microsecondsSince(std::chrono::high_resolution_clock::time_point start)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void loadSurfaces(std::string pathToObj, bool isLight, uint32_t shapeIdx, std::vector<std::string>* dependencies,
+    std::vector<Surface>& surfaces, TaskGroup& tasks, LoadTimes& times)
+{
+    TRACE_SCOPE("Load OBJ", pathToObj);
     std::string objDirectory;
     const size_t last_slash_idx = pathToObj.rfind('/');
     if (std::string::npos != last_slash_idx) {
         objDirectory = pathToObj.substr(0, last_slash_idx);
     }
 
-    std::vector<Surface> surfaces;
+    auto startTime = std::chrono::high_resolution_clock::now();
+    if (isPlyPath(pathToObj)) {
+        surfaces.clear();
+        surfaces.emplace_back();
+        Surface& surf = surfaces.back();
+        surf.isLight = isLight;
+        surf.shapeIdx = shapeIdx;
+        if (!loadPly(pathToObj, surf))
+            throw std::runtime_error("Could not load " + pathToObj);
+        surf.encodeVertices(vertexEncoding);
+        surf.bsdf = BSDF("", "", Vector3f(1, 1, 1), 1);
+        if (dependencies != nullptr)
+            dependencies->push_back(pathToObj);
+        times.parse += microsecondsSince(startTime);
+
+        tasks.run([&surf, &times]() {
+            auto startTime = std::chrono::high_resolution_clock::now();
+            surf.buildBVH();
+            times.bvh += microsecondsSince(startTime);
+        });
+        return;
+    }
 
-    tinyobj::ObjReader reader;
-    tinyobj::ObjReaderConfig reader_config;
-    if (!reader.ParseFromFile(pathToObj, reader_config)) {
-        if (!reader.Error().empty()) {
-            std::cerr << "TinyObjReader: " << reader.Error();
-        }
-        exit(1);
+    ObjFile obj;
+    {
+        TRACE_SCOPE("Parse OBJ", pathToObj);
+        loadObj(pathToObj, obj);
     }
 
-    if (!reader.Warning().empty()) {
-        std::cout << "TinyObjReader: " << reader.Warning();
+    if (dependencies != nullptr) {
+        dependencies->push_back(pathToObj);
+        for (auto& name : obj.materialLibraries)
+            dependencies->push_back(objDirectory + "/" + name);
     }
 
-    auto& attrib = reader.GetAttrib();
-    auto& shapes = reader.GetShapes();
-    auto& materials = reader.GetMaterials();
+    auto& attrib = obj.attrib;
+    auto& shapes = obj.shapes;
+    auto& materials = obj.materials;
+    times.parse += microsecondsSince(startTime);
+    startTime = std::chrono::high_resolution_clock::now();
+
+    // The tasks below point into surfaces, so it must not reallocate
+    surfaces.clear();
+    surfaces.reserve(shapes.size());
 
     // Loop over shapes
     for (size_t s = 0; s < shapes.size(); s++) {
-        Surface surf;
+        surfaces.emplace_back();
+        Surface& surf = surfaces.back();
         surf.isLight = isLight;
         surf.shapeIdx = shapeIdx;
-        std::set<int> materialIds;
+        const tinyobj::mesh_t& mesh = shapes[s].mesh;
+        // Every face has to use the material of the first one
+        int materialId = mesh.material_ids.empty() ? -1 : mesh.material_ids[0];
+
+        // Normals and uvs are only stored if some corner has them
+        bool hasNormals = false, hasUvs = false;
+        for (auto& idx : mesh.indices) {
+            hasNormals = hasNormals || idx.normal_index >= 0;
+            hasUvs = hasUvs || idx.texcoord_index >= 0;
+        }
+
+        // Corners with the same position, normal and uv indices share a vertex
+        std::unordered_map<ObjCorner, int, ObjCornerHash> cornerVertices;
+        cornerVertices.reserve(mesh.indices.size());
+        surf.reserve(mesh.num_face_vertices.size());
 
         // Loop over faces(polygon)
         size_t index_offset = 0;
-        for (size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++) {
-            size_t fv = size_t(shapes[s].mesh.num_face_vertices[f]);
-            if (fv > 3) {
-                std::cerr << "Not a triangle mesh" << std::endl;
-                exit(1);
-            }
+        for (size_t f = 0; f < mesh.num_face_vertices.size(); f++) {
+            size_t fv = size_t(mesh.num_face_vertices[f]);
+            if (fv != 3)
+                throw std::runtime_error("Not a triangle mesh: " + pathToObj);
 
-            // Loop over vertices in the face. Assume 3 vertices per-face
-            Vector3f vertices[3], normals[3];
-            Vector2f uvs[3];
+            Vector3i index;
             for (size_t v = 0; v < fv; v++) {
-                // access to vertex
-                tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + v];
-                tinyobj::real_t vx = attrib.vertices[3 * size_t(idx.vertex_index) + 0];
-                tinyobj::real_t vy = attrib.vertices[3 * size_t(idx.vertex_index) + 1];
-                tinyobj::real_t vz = attrib.vertices[3 * size_t(idx.vertex_index) + 2];
-
-                // Check if `normal_index` is zero or positive. negative = no normal data
-                if (idx.normal_index >= 0) {
-                    tinyobj::real_t nx = attrib.normals[3 * size_t(idx.normal_index) + 0];
-                    tinyobj::real_t ny = attrib.normals[3 * size_t(idx.normal_index) + 1];
-                    tinyobj::real_t nz = attrib.normals[3 * size_t(idx.normal_index) + 2];
-
-                    normals[v] = Vector3f(nx, ny, nz);
+                tinyobj::index_t idx = mesh.indices[index_offset + v];
+                ObjCorner corner = { idx.vertex_index, idx.normal_index, idx.texcoord_index };
+                auto inserted = cornerVertices.insert(std::make_pair(corner, int(surf.vertices.size())));
+                index[v] = inserted.first->second;
+                if (!inserted.second)
+                    continue;
+
+                surf.vertices.push_back(Vector3f(
+                    attrib.vertices[3 * size_t(idx.vertex_index) + 0],
+                    attrib.vertices[3 * size_t(idx.vertex_index) + 1],
+                    attrib.vertices[3 * size_t(idx.vertex_index) + 2]));
+
+                // Negative indices mean no normal or texcoord data
+                if (hasNormals) {
+                    Vector3f normal;
+                    if (idx.normal_index >= 0) {
+                        normal = Vector3f(
+                            attrib.normals[3 * size_t(idx.normal_index) + 0],
+                            attrib.normals[3 * size_t(idx.normal_index) + 1],
+                            attrib.normals[3 * size_t(idx.normal_index) + 2]);
+                    }
+                    surf.normals.push_back(normal);
                 }
-
-                // Check if `texcoord_index` is zero or positive. negative = no texcoord data
-                if (idx.texcoord_index >= 0) {
-                    tinyobj::real_t tx = attrib.texcoords[2 * size_t(idx.texcoord_index) + 0];
-                    tinyobj::real_t ty = attrib.texcoords[2 * size_t(idx.texcoord_index) + 1];
-
-                    uvs[v] = Vector2f(tx, ty);
+                if (hasUvs) {
+                    Vector2f uv;
+                    if (idx.texcoord_index >= 0) {
+                        uv = Vector2f(
+                            attrib.texcoords[2 * size_t(idx.texcoord_index) + 0],
+                            attrib.texcoords[2 * size_t(idx.texcoord_index) + 1]);
+                    }
+                    surf.uvs.push_back(uv);
                 }
-
-                vertices[v] = Vector3f(vx, vy, vz);
-            }
-
-            int vSize = surf.vertices.size();
-            Vector3i findex(vSize, vSize + 1, vSize + 2);
-
-            surf.vertices.push_back(vertices[0]);
-            surf.vertices.push_back(vertices[1]);
-            surf.vertices.push_back(vertices[2]);
-
-            surf.normals.push_back(normals[0]);
-            surf.normals.push_back(normals[1]);
-            surf.normals.push_back(normals[2]);
-
-            surf.uvs.push_back(uvs[0]);
-            surf.uvs.push_back(uvs[1]);
-            surf.uvs.push_back(uvs[2]);
-
-            surf.indices.push_back(findex);
-
-            // Create Triangle
-            Tri triangle;
-            triangle.v1 = vertices[0];
-            triangle.v2 = vertices[1];
-            triangle.v3 = vertices[2];
-
-            triangle.uv1 = uvs[0];
-            triangle.uv2 = uvs[1];
-            triangle.uv3 = uvs[2];
-
-            triangle.normal = Normalize(normals[0] + normals[1] + normals[2]);
-            triangle.centroid = (triangle.v1 + triangle.v2 + triangle.v3) / 3.f;
-
-            for (int i = 0; i < 3; i++) {
-                triangle.bbox.min = Vector3f(
-                    std::min(triangle.bbox.min.x, vertices[i].x),
-                    std::min(triangle.bbox.min.y, vertices[i].y),
-                    std::min(triangle.bbox.min.z, vertices[i].z)
-                );
-
-                triangle.bbox.max = Vector3f(
-                    std::max(triangle.bbox.max.x, vertices[i].x),
-                    std::max(triangle.bbox.max.y, vertices[i].y),
-                    std::max(triangle.bbox.max.z, vertices[i].z)
-                );
-
-                triangle.bbox.centroid = (triangle.bbox.min + triangle.bbox.max) / 2.f;
             }
 
-            surf.tris.push_back(triangle);
-
-            // BVH indirection indices
-            surf.triIdxs.push_back(f);
-
-            // Update surface AABB
-            surf.bbox.min = Vector3f(
-                std::min(surf.bbox.min.x, triangle.bbox.min.x),
-                std::min(surf.bbox.min.y, triangle.bbox.min.y),
-                std::min(surf.bbox.min.z, triangle.bbox.min.z)
-            );
-
-            surf.bbox.max = Vector3f(
-                std::max(surf.bbox.max.x, triangle.bbox.max.x),
-                std::max(surf.bbox.max.y, triangle.bbox.max.y),
-                std::max(surf.bbox.max.z, triangle.bbox.max.z)
-            );
-
-            surf.bbox.centroid = (surf.bbox.min + surf.bbox.max) / 2.f;
+            surf.addTriangle(index);
 
             // per-face material
-            materialIds.insert(shapes[s].mesh.material_ids[f]);
+            if (mesh.material_ids[f] != materialId)
+                throw std::runtime_error("One of the meshes has more than one material. This is not allowed.");
 
             index_offset += fv;
         }
+        // The number of vertices is only known now, drop the spare capacity
+        surf.vertices.shrink_to_fit();
+        surf.uvs.shrink_to_fit();
+        surf.encodeVertices(vertexEncoding);
 
-        if (materialIds.size() > 1) {
-            std::cerr << "One of the meshes has more than one material. This is not allowed." << std::endl;
-            exit(1);
-        }
-
-
-        if (materialIds.size() == 0) {
+        if (mesh.num_face_vertices.empty()) {
             std::cerr << "One of the meshes has no material definition, may cause unexpected behaviour." << std::endl;
         } else {
             // Load textures from Materials
-            auto matId = *materialIds.begin();
+            auto matId = materialId;
             if (matId != -1) {
                 auto mat = materials[matId];
 
@@ -173,30 +197,39 @@ std::vector<Surface> createSurfaces(std::string pathToObj, bool isLight, uint32_
                 if (mat.specular_texname != "") {
                     alphaTexname = objDirectory + "/" + mat.alpha_texname;
                 }
-                surf.bsdf = BSDF(
-                    diffuseTexname,
-                    alphaTexname,
-                    diffuse,
-                    alpha
-                );
+                if (dependencies != nullptr) {
+                    if (!diffuseTexname.empty())
+                        dependencies->push_back(diffuseTexname);
+                    if (!alphaTexname.empty())
+                        dependencies->push_back(alphaTexname);
+                }
+                if (diffuseTexname.empty() && alphaTexname.empty()) {
+                    surf.bsdf = BSDF("", "", diffuse, alpha);
+                }
+                else {
+                    // Decoding dominates, so every BSDF with textures is its own task
+                    tasks.run([&surf, &times, diffuseTexname, alphaTexname, diffuse, alpha]() {
+                        auto startTime = std::chrono::high_resolution_clock::now();
+                        surf.bsdf = BSDF(diffuseTexname, alphaTexname, diffuse, alpha);
+                        times.textures += microsecondsSince(startTime);
+                        times.numTextures += int(!diffuseTexname.empty()) + int(!alphaTexname.empty());
+                    });
+                }
             } else {
                 surf.bsdf = BSDF("", "", Vector3f(1, 1, 1), 1);
             }
         }
 
-        // Allocate memory for BVH & build the BVH
-        surf.nodes = (BVHNode*)malloc((2 * surf.triIdxs.size() - 1) * sizeof(BVHNode));
-        for (int i = 0; i < 2 * surf.triIdxs.size() - 1; i++) {
-            surf.nodes[i] = BVHNode();
-        }
-
-        surf.buildBVH();
+        // Start the BVH build as soon as the geometry is ready
+        tasks.run([&surf, &times]() {
+            auto startTime = std::chrono::high_resolution_clock::now();
+            surf.buildBVH();
+            times.bvh += microsecondsSince(startTime);
+        });
 
-        surfaces.push_back(surf);
         shapeIdx++;
     }
-
-    return surfaces;
+    times.geometry += microsecondsSince(startTime);
 }
 
 Interaction Surface::rayPlaneIntersect(Ray ray, Vector3f p, Vector3f n)
@@ -258,8 +291,152 @@ Interaction Surface::rayTriangleIntersect(Ray ray, Vector3f v1, Vector3f v2, Vec
     return si;
 }
 
+/**
+ * Appends a triangle with its own three vertices, normals and uvs. The
+ * surface's normals and uvs have to be in use, i.e. hold an entry for every
+ * vertex. The BVH has to be rebuilt afterwards.
+ */
+void Surface::addTriangle(Vector3f vertices[3], Vector3f normals[3], Vector2f uvs[3])
+{
+    int vSize = this->vertices.size();
+    for (int i = 0; i < 3; i++) {
+        this->vertices.push_back(vertices[i]);
+        this->normals.push_back(normals[i]);
+        this->uvs.push_back(uvs[i]);
+    }
+    this->addTriangle(Vector3i(vSize, vSize + 1, vSize + 2));
+}
+
+/**
+ * Appends a triangle between existing vertices and grows the bounds. The BVH
+ * has to be rebuilt afterwards.
+ */
+void Surface::addTriangle(Vector3i index)
+{
+    Vector3f v1 = this->position(index.x), v2 = this->position(index.y), v3 = this->position(index.z);
+    if (this->hasNormals())
+        this->triNormals.push_back(Normalize(this->normals[index.x] + this->normals[index.y] + this->normals[index.z]));
+    else
+        this->triNormals.push_back(Normalize(Cross(v2 - v1, v3 - v1)));
+    this->indices.push_back(index);
+
+    // BVH indirection indices
+    this->triIdxs.push_back(uint32_t(this->indices.size() - 1));
+
+    // Update surface AABB
+    this->bbox.min = Vector3f(
+        std::min(std::min(this->bbox.min.x, v1.x), std::min(v2.x, v3.x)),
+        std::min(std::min(this->bbox.min.y, v1.y), std::min(v2.y, v3.y)),
+        std::min(std::min(this->bbox.min.z, v1.z), std::min(v2.z, v3.z))
+    );
+
+    this->bbox.max = Vector3f(
+        std::max(std::max(this->bbox.max.x, v1.x), std::max(v2.x, v3.x)),
+        std::max(std::max(this->bbox.max.y, v1.y), std::max(v2.y, v3.y)),
+        std::max(std::max(this->bbox.max.z, v1.z), std::max(v2.z, v3.z))
+    );
+
+    this->bbox.centroid = (this->bbox.min + this->bbox.max) / 2.f;
+}
+
+// Maps t in [0, 1] to 0..65535
+static uint32_t encodeUnorm16(float t)
+{
+    return uint32_t(std::lround(std::min(std::max(t, 0.f), 1.f) * 65535.f));
+}
+
+/**
+ * Called once every triangle is added. The vertex normals are freed in every
+ * encoding, since they only go into the triangle normals, which are shaded
+ * flat. Unless encoding is VERTEX_FLOAT, uvs are then replaced by 16-bit
+ * fixed point over the range of the surface's uvs. With
+ * VERTEX_COMPACT_POSITIONS, positions become 16-bit fixed point within the
+ * bounds of the vertices, which moves them by up to 1/131070 of the
+ * surface's extent, and the bounds are updated to the decoded positions.
+ * The BVH has to be built afterwards, and no triangles with new vertices can
+ * be added.
+ */
+void Surface::encodeVertices(VertexEncoding encoding)
+{
+    this->normals = TrackedVector<Vector3f, MEM_GEOMETRY>();
+
+    if (encoding == VERTEX_FLOAT || this->encoding != VERTEX_FLOAT)
+        return;
+    this->encoding = encoding;
+
+    if (!this->uvs.empty()) {
+        Vector2f lower = this->uvs[0], upper = this->uvs[0];
+        for (auto& uv : this->uvs) {
+            lower = Vector2f(std::min(lower.x, uv.x), std::min(lower.y, uv.y));
+            upper = Vector2f(std::max(upper.x, uv.x), std::max(upper.y, uv.y));
+        }
+        Vector2f extent = upper - lower;
+        this->uvOffset = lower;
+        this->uvScale = Vector2f(extent.x / 65535.f, extent.y / 65535.f);
+        this->packedUvs.resize(this->uvs.size());
+        for (size_t i = 0; i < this->uvs.size(); i++) {
+            Vector2f uv = this->uvs[i] - lower;
+            this->packedUvs[i] = encodeUnorm16(extent.x > 0.f ? uv.x / extent.x : 0.f)
+                | (encodeUnorm16(extent.y > 0.f ? uv.y / extent.y : 0.f) << 16);
+        }
+        this->uvs = TrackedVector<Vector2f, MEM_GEOMETRY>();
+    }
+
+    if (encoding == VERTEX_COMPACT_POSITIONS && !this->vertices.empty()) {
+        Vector3f lower = this->vertices[0], upper = this->vertices[0];
+        for (auto& v : this->vertices) {
+            lower = Vector3f(std::min(lower.x, v.x), std::min(lower.y, v.y), std::min(lower.z, v.z));
+            upper = Vector3f(std::max(upper.x, v.x), std::max(upper.y, v.y), std::max(upper.z, v.z));
+        }
+        Vector3f extent = upper - lower;
+        this->positionOffset = lower;
+        this->positionScale = extent / 65535.f;
+        this->packedVertices.resize(this->vertices.size());
+        for (size_t i = 0; i < this->vertices.size(); i++) {
+            Vector3f v = this->vertices[i] - lower;
+            PackedPosition& packed = this->packedVertices[i];
+            packed.x = uint16_t(encodeUnorm16(extent.x > 0.f ? v.x / extent.x : 0.f));
+            packed.y = uint16_t(encodeUnorm16(extent.y > 0.f ? v.y / extent.y : 0.f));
+            packed.z = uint16_t(encodeUnorm16(extent.z > 0.f ? v.z / extent.z : 0.f));
+        }
+        this->vertices = TrackedVector<Vector3f, MEM_GEOMETRY>();
+
+        this->bbox = AABB();
+        for (auto& index : this->indices) {
+            for (int k = 0; k < 3; k++) {
+                Vector3f v = this->position(index[k]);
+                this->bbox.min = Vector3f(std::min(this->bbox.min.x, v.x), std::min(this->bbox.min.y, v.y), std::min(this->bbox.min.z, v.z));
+                this->bbox.max = Vector3f(std::max(this->bbox.max.x, v.x), std::max(this->bbox.max.y, v.y), std::max(this->bbox.max.z, v.z));
+            }
+        }
+        this->bbox.centroid = (this->bbox.min + this->bbox.max) / 2.f;
+    }
+}
+
+void Surface::reserve(size_t numTriangles)
+{
+    this->indices.reserve(this->indices.size() + numTriangles);
+    this->triNormals.reserve(this->triNormals.size() + numTriangles);
+    this->triIdxs.reserve(this->triIdxs.size() + numTriangles);
+}
+
 void Surface::buildBVH()
 {
+    TRACE_SCOPE("Build surface BVH");
+    auto startTime = std::chrono::high_resolution_clock::now();
+
+    // Allocate memory for BVH
+    trackedFree(MEM_BVH, this->nodes);
+    this->nodes = nullptr;
+    this->numBVHNodes = 0;
+    if (this->triIdxs.empty())
+        return;
+
+    this->nodes = (BVHNode*)trackedMalloc(MEM_BVH, (2 * this->triIdxs.size() - 1) * sizeof(BVHNode));
+    for (int i = 0; i < 2 * this->triIdxs.size() - 1; i++) {
+        this->nodes[i] = BVHNode();
+    }
+
     // Root node
     this->numBVHNodes += 1;
 
@@ -267,8 +444,16 @@ void Surface::buildBVH()
     rootNode.firstPrim = 0;
     rootNode.primCount = this->triIdxs.size();
 
+    this->centroids.resize(this->indices.size());
+    for (size_t t = 0; t < this->indices.size(); t++) {
+        Vector3i index = this->indices[t];
+        this->centroids[t] = (this->position(index.x) + this->position(index.y) + this->position(index.z)) / 3.f;
+    }
+
     this->updateNodeBounds(0);
     this->subdivideNode(0);
+    this->centroids = TrackedVector<Vector3f, MEM_BVH>();
+    this->bvhBuildMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
 }
 
 uint32_t Surface::getIdx(uint32_t idx)
@@ -281,18 +466,21 @@ void Surface::updateNodeBounds(uint32_t nodeIdx)
     BVHNode& node = this->nodes[nodeIdx];
 
     for (int i = 0; i < node.primCount; i++) {
-        auto triangle = this->tris[this->getIdx(i + node.firstPrim)];
-        node.bbox.min = Vector3f(
-            std::min(node.bbox.min.x, triangle.bbox.min.x),
-            std::min(node.bbox.min.y, triangle.bbox.min.y),
-            std::min(node.bbox.min.z, triangle.bbox.min.z)
-        );
-
-        node.bbox.max = Vector3f(
-            std::max(node.bbox.max.x, triangle.bbox.max.x),
-            std::max(node.bbox.max.y, triangle.bbox.max.y),
-            std::max(node.bbox.max.z, triangle.bbox.max.z)
-        );
+        Vector3i index = this->indices[this->getIdx(i + node.firstPrim)];
+        for (int k = 0; k < 3; k++) {
+            Vector3f v = this->position(index[k]);
+            node.bbox.min = Vector3f(
+                std::min(node.bbox.min.x, v.x),
+                std::min(node.bbox.min.y, v.y),
+                std::min(node.bbox.min.z, v.z)
+            );
+
+            node.bbox.max = Vector3f(
+                std::max(node.bbox.max.x, v.x),
+                std::max(node.bbox.max.y, v.y),
+                std::max(node.bbox.max.z, v.z)
+            );
+        }
 
         node.bbox.centroid = (node.bbox.min + node.bbox.max) / 2.f;
     }
@@ -315,7 +503,7 @@ void Surface::subdivideNode(uint32_t nodeIdx)
     int j = i + node.primCount - 1;
 
     while (i <= j) {
-        if (this->tris[this->getIdx(i)].centroid[ax] < split)
+        if (this->centroids[this->getIdx(i)][ax] < split)
             i++;
         else {
             auto temp = this->triIdxs[i];
@@ -351,20 +539,21 @@ void Surface::intersectBVH(uint32_t nodeIdx, Ray& ray, Interaction& si)
 {
     BVHNode& node = this->nodes[nodeIdx];
 
+    STAT_INC(STAT_AABB_TESTS);
     if (!node.bbox.intersects(ray)) return;
+    STAT_INC(STAT_BVH_NODES);
 
     if (node.primCount != 0) {
         // Leaf
         for (uint32_t i = 0; i < node.primCount; i++) {
-            Vector3f v1 = this->tris[this->getIdx(i + node.firstPrim)].v1;
-            Vector3f v2 = this->tris[this->getIdx(i + node.firstPrim)].v2;
-            Vector3f v3 = this->tris[this->getIdx(i + node.firstPrim)].v3;
-            Vector3f normal = this->tris[this->getIdx(i + node.firstPrim)].normal;
-
-            Vector2f uv1 = this->tris[this->getIdx(i + node.firstPrim)].uv1;
-            Vector2f uv2 = this->tris[this->getIdx(i + node.firstPrim)].uv2;
-            Vector2f uv3 = this->tris[this->getIdx(i + node.firstPrim)].uv3;
-
+            uint32_t triIdx = this->getIdx(i + node.firstPrim);
+            Vector3i index = this->indices[triIdx];
+            Vector3f v1 = this->position(index.x);
+            Vector3f v2 = this->position(index.y);
+            Vector3f v3 = this->position(index.z);
+            Vector3f normal = this->triNormals[triIdx];
+
+            STAT_INC(STAT_TRIANGLE_TESTS);
             Interaction siIntermediate = this->rayTriangleIntersect(
                 ray, v1, v2, v3, normal);
 
@@ -377,6 +566,12 @@ void Surface::intersectBVH(uint32_t nodeIdx, Ray& ray, Interaction& si)
                 float alpha = 0.5f * Cross(si.p - v2, v3 - v2).Length() / triArea;
                 float gamma = 0.5f * Cross(si.p - v2, v1 - v2).Length() / triArea;
                 float beta = 0.5f * Cross(si.p - v1, v3 - v1).Length() / triArea;
+                Vector2f uv1, uv2, uv3;
+                if (this->hasUvs()) {
+                    uv1 = this->uv(index.x);
+                    uv2 = this->uv(index.y);
+                    uv3 = this->uv(index.z);
+                }
                 Vector2f uv = alpha * uv1 +
                     beta * uv2 +
                     gamma * uv3;
@@ -405,7 +600,79 @@ Interaction Surface::rayIntersect(Ray& ray)
     Interaction si;
     si.didIntersect = false;
 
-    this->intersectBVH(0, ray, si);
+    if (this->nodes != nullptr)
+        this->intersectBVH(0, ray, si);
 
     return si;
-}
\ No newline at end of file
+}
+
+size_t Surface::memoryUsage()
+{
+    return this->vertices.capacity() * sizeof(Vector3f)
+        + this->normals.capacity() * sizeof(Vector3f)
+        + this->indices.capacity() * sizeof(Vector3i)
+        + this->uvs.capacity() * sizeof(Vector2f)
+        + this->packedVertices.capacity() * sizeof(PackedPosition)
+        + this->packedUvs.capacity() * sizeof(uint32_t)
+        + this->triNormals.capacity() * sizeof(Vector3f)
+        + this->triIdxs.capacity() * sizeof(uint32_t)
+        + (this->triIdxs.empty() ? 0 : 2 * this->triIdxs.size() - 1) * sizeof(BVHNode)
+        + this->bsdf.memoryUsage();
+}
+
+Surface::Surface(Surface&& other)
+{
+    *this = std::move(other);
+}
+
+/**
+ * Takes over the buffers, BVH nodes and textures of other, which is left
+ * without BVH nodes and textures. Whatever this surface held before has to
+ * be released first.
+ */
+Surface& Surface::operator=(Surface&& other)
+{
+    if (this == &other)
+        return *this;
+
+    this->vertices = std::move(other.vertices);
+    this->normals = std::move(other.normals);
+    this->uvs = std::move(other.uvs);
+    this->indices = std::move(other.indices);
+
+    this->encoding = other.encoding;
+    this->packedVertices = std::move(other.packedVertices);
+    this->packedUvs = std::move(other.packedUvs);
+    this->positionOffset = other.positionOffset;
+    this->positionScale = other.positionScale;
+    this->uvOffset = other.uvOffset;
+    this->uvScale = other.uvScale;
+
+    this->nodes = other.nodes;
+    this->numBVHNodes = other.numBVHNodes;
+    this->bvhBuildMs = other.bvhBuildMs;
+    other.nodes = nullptr;
+    other.numBVHNodes = 0;
+
+    this->triNormals = std::move(other.triNormals);
+    this->triIdxs = std::move(other.triIdxs);
+    this->centroids = std::move(other.centroids);
+    this->bbox = other.bbox;
+    this->bsdf = other.bsdf;
+    other.bsdf = BSDF();
+
+    this->isLight = other.isLight;
+    this->shapeIdx = other.shapeIdx;
+    return *this;
+}
+
+/**
+ * Frees the BVH nodes and textures of the surface. A surface that was moved
+ * from has neither.
+ */
+void Surface::release()
+{
+    trackedFree(MEM_BVH, this->nodes);
+    this->nodes = nullptr;
+    this->bsdf.release();
+}
@@ -0,0 +1,78 @@
+#include "temporal.h"
+#include "parallel.h"
+
+long long TemporalCache::reproject(Scene& scene, Camera camera, long long spp, Framebuffer& framebuffer)
+{
+    Vector2i res = camera.imageResolution;
+    size_t numPixels = size_t(res.x) * res.y;
+    this->nextPosition.assign(numPixels, Vector3f(0.f));
+    this->nextNormal.assign(numPixels, Vector3f(0.f));
+    this->nextHit.assign(numPixels, 0);
+
+    framebuffer.allocate(res);
+    long long keep = std::max(0ll, spp - std::max(1ll, (long long)std::ceil(this->refreshFraction * spp)));
+    bool reuse = this->hasHistory && keep > 0;
+    Vector2i historyRes = this->history.resolution;
+
+    std::vector<uint8_t> reused(numPixels, 0);
+    parallelFor(0, res.y, 1, [&](int begin, int end) {
+        for (int y = begin; y < end; y++) {
+            for (int x = 0; x < res.x; x++) {
+                int p = framebuffer.pixelIndex(x, y);
+
+                // Pixels showing an emitter in front of geometry are not reused
+                Ray ray = camera.centerRay(x, y);
+                Interaction si = scene.rayIntersect(ray);
+                Ray emitterRay = camera.centerRay(x, y);
+                Interaction siEmitter = scene.rayEmitterIntersect(emitterRay);
+                if (!si.didIntersect || (siEmitter.didIntersect && siEmitter.t < si.t))
+                    continue;
+
+                this->nextPosition[p] = si.p;
+                this->nextNormal[p] = si.n;
+                this->nextHit[p] = 1;
+                if (!reuse)
+                    continue;
+
+                Vector2f prev;
+                if (!this->camera.project(si.p, prev))
+                    continue;
+                int px = int(std::floor(prev.x)), py = int(std::floor(prev.y));
+                if (px < 0 || py < 0 || px >= historyRes.x || py >= historyRes.y)
+                    continue;
+
+                int q = this->history.pixelIndex(px, py);
+                if (!this->hit[q])
+                    continue;
+                float distance = (si.p - this->camera.from).Length();
+                float prevDistance = (this->position[q] - this->camera.from).Length();
+                if (std::abs(distance - prevDistance) > this->depthTolerance * distance
+                    || Dot(si.n, this->normal[q]) < this->normalTolerance)
+                    continue;
+
+                // Rescale the history to at most keep samples, keeping its mean
+                uint32_t count = this->history.sampleCount[q];
+                if (count == 0)
+                    continue;
+                float scale = count > keep ? keep / float(count) : 1.f;
+                framebuffer.color[3 * p + 0] = this->history.color[3 * q + 0] * scale;
+                framebuffer.color[3 * p + 1] = this->history.color[3 * q + 1] * scale;
+                framebuffer.color[3 * p + 2] = this->history.color[3 * q + 2] * scale;
+                framebuffer.sampleCount[p] = uint32_t(std::min<long long>(count, keep));
+                reused[p] = 1;
+            }
+        }
+    });
+
+    this->camera = camera;
+    return std::count(reused.begin(), reused.end(), 1);
+}
+
+void TemporalCache::store(Framebuffer& framebuffer)
+{
+    this->position.swap(this->nextPosition);
+    this->normal.swap(this->nextNormal);
+    this->hit.swap(this->nextHit);
+    this->history = framebuffer;
+    this->hasHistory = true;
+}
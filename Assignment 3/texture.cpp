@@ -1,4 +1,9 @@
 #include "texture.h"
+#include "memory.h"
+#include "trace.h"
+
+#include <cstring>
+#include <stdexcept>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb/stb_image.h"
@@ -19,6 +24,72 @@ float gammaTransform(float val) {
     return clamped;
 }
 
+/**
+ * Lookup tables that reproduce static_cast<uint32_t>(gammaTransform(val) * 255)
+ * without calling std::pow.
+ * thresholds[k] is the smallest value that encodes to k. codes[] is indexed by
+ * the top bits of the float representation, i.e. 2^11 bins per octave between
+ * 2^-24 and 1. A bin is narrower than one code step everywhere in that range, so
+ * the code of its lower edge needs at most one correction against thresholds[].
+ */
+struct GammaTable {
+    static const uint32_t minBits = 103u << 23; // 2^-24
+    static const uint32_t maxBits = 127u << 23; // 1.0
+
+    float thresholds[257];
+    std::vector<uint8_t> codes;
+
+    static uint32_t reference(float val)
+    {
+        return static_cast<uint32_t>(gammaTransform(val) * 255.0f);
+    }
+
+    static float fromBits(uint32_t bits)
+    {
+        float val;
+        std::memcpy(&val, &bits, sizeof(val));
+        return val;
+    }
+
+    GammaTable()
+    {
+        // Binary search over the (monotonic) bit patterns of non-negative floats
+        this->thresholds[0] = 0.f;
+        for (uint32_t k = 1; k < 256; k++) {
+            uint32_t lo = 0, hi = maxBits;
+            while (lo < hi) {
+                uint32_t mid = lo + (hi - lo) / 2;
+                if (reference(fromBits(mid)) >= k)
+                    hi = mid;
+                else
+                    lo = mid + 1;
+            }
+            this->thresholds[k] = fromBits(lo);
+        }
+        this->thresholds[256] = std::numeric_limits<float>::infinity();
+
+        this->codes.resize((maxBits - minBits) >> 12);
+        for (size_t i = 0; i < this->codes.size(); i++)
+            this->codes[i] = uint8_t(reference(fromBits(minBits + (uint32_t(i) << 12))));
+    }
+};
+
+static const GammaTable gammaTable;
+
+uint32_t gammaEncode(float val)
+{
+    // Also catches NaN
+    if (!(val > 0.f)) return 0;
+    if (val >= 1.f) return 255;
+
+    uint32_t bits;
+    std::memcpy(&bits, &val, sizeof(bits));
+    if (bits < GammaTable::minBits) return 0;
+
+    uint32_t code = gammaTable.codes[(bits - GammaTable::minBits) >> 12];
+    return code + (val >= gammaTable.thresholds[code + 1]);
+}
+
 Texture::Texture(std::string pathToImage)
 {
     size_t pos = pathToImage.find(".exr");
@@ -36,6 +107,7 @@ Texture::Texture(std::string pathToImage)
         this->type = TextureType::FLOAT_ALPHA;
         this->loadExr(pathToImage);
     }
+    MemoryStats::allocate(MEM_TEXTURES, this->memoryUsage());
 }
 
 void Texture::allocate(TextureType type, Vector2i resolution)
@@ -51,6 +123,7 @@ void Texture::allocate(TextureType type, Vector2i resolution)
         float* dpointer = (float*)malloc(this->resolution.x * this->resolution.y * 4 * sizeof(float));
         this->data = (uint64_t)dpointer;
     }
+    MemoryStats::allocate(MEM_TEXTURES, this->memoryUsage());
 }
 
 
@@ -107,6 +180,7 @@ void Texture::writePixelColor(Vector3f color, int x, int y)
 
 void Texture::loadJpg(std::string pathToJpg)
 {
+    TRACE_SCOPE("Decode JPG", pathToJpg);
     Vector2i res;
     int comp;
     unsigned char* image = stbi_load(pathToJpg.c_str(), &res.x, &res.y, &comp, STBI_rgb_alpha);
@@ -127,14 +201,13 @@ void Texture::loadJpg(std::string pathToJpg)
         }
     }
     else {
-        std::cerr << "Could not load .jpg texture from " << pathToJpg << std::endl;
-        std::cerr << stbi_failure_reason() << std::endl;
-        exit(1);
+        throw std::runtime_error("Could not load .jpg texture from " + pathToJpg + ": " + stbi_failure_reason());
     }
 }
 
 void Texture::loadPng(std::string pathToPng)
 {
+    TRACE_SCOPE("Decode PNG", pathToPng);
     Vector2i res;
     int comp;
     unsigned char* image = stbi_load(pathToPng.c_str(), &res.x, &res.y, &comp, STBI_rgb_alpha);
@@ -155,31 +228,46 @@ void Texture::loadPng(std::string pathToPng)
         }
     }
     else {
-        std::cerr << "Could not load .png texture from " << pathToPng << std::endl;
-        std::cerr << stbi_failure_reason() << std::endl;
-        exit(1);
+        throw std::runtime_error("Could not load .png texture from " + pathToPng + ": " + stbi_failure_reason());
     }
 }
 
 void Texture::loadExr(std::string pathToExr)
 {
+    TRACE_SCOPE("Decode EXR", pathToExr);
     int width;
     int height;
     const char* err = nullptr; // or nullptr in C++11
     
     float* data;
     int ret = LoadEXR(&data, &width, &height, pathToExr.c_str(), &err);
-    this->data = (uint64_t)data;
 
     if (ret != TINYEXR_SUCCESS) {
-        std::cerr << "Could not load .exr texture map from " << pathToExr << std::endl;
-        exit(1);
+        std::string reason = err ? err : "";
+        if (err) FreeEXRErrorMessage(err);
+        throw std::runtime_error("Could not load .exr texture map from " + pathToExr + ": " + reason);
     }
     else {
+        this->data = (uint64_t)data;
         this->resolution = Vector2i(width, height);
     }
 }
 
+size_t Texture::memoryUsage()
+{
+    if (this->data == 0)
+        return 0;
+    size_t texelSize = this->type == TextureType::FLOAT_ALPHA ? 4 * sizeof(float) : sizeof(uint32_t);
+    return size_t(this->resolution.x) * this->resolution.y * texelSize;
+}
+
+void Texture::release()
+{
+    MemoryStats::deallocate(MEM_TEXTURES, this->memoryUsage());
+    free((void*)this->data);
+    this->data = 0;
+}
+
 void Texture::save(std::string path)
 {
     size_t pos = path.find(".png");
@@ -194,6 +282,7 @@ void Texture::save(std::string path)
 
 void Texture::saveExr(std::string path)
 {
+    TRACE_SCOPE("Write EXR", path);
     if (this->type == TextureType::FLOAT_ALPHA) {
         uint64_t hostData = this->data;
 
@@ -212,6 +301,7 @@ void Texture::saveExr(std::string path)
 
 void Texture::savePng(std::string path) 
 {
+    TRACE_SCOPE("Write PNG", path);
     if (this->type == TextureType::UNSIGNED_INTEGER_ALPHA) {
         uint64_t hostData = this->data;
         const uint32_t* data = (const uint32_t*)hostData;
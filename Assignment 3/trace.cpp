@@ -0,0 +1,140 @@
+#include "trace.h"
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+#include "json/include/nlohmann/json.hpp"
+
+struct TraceEvent {
+    const char* name;
+    std::string detail;
+    int64_t start, duration;
+    int tid;
+};
+
+static std::atomic<bool> tracing(false);
+static std::chrono::steady_clock::time_point traceStart;
+
+static std::mutex eventsMutex;
+static std::vector<TraceEvent> events;
+static std::vector<std::pair<int, std::string>> threadNames;
+static std::atomic<int> nextThreadId(1000);
+
+// Events of one thread, handed to the global list when the thread exits
+struct ThreadTrace {
+    int tid = -1;
+    std::vector<TraceEvent> events;
+
+    ~ThreadTrace()
+    {
+        std::lock_guard<std::mutex> lock(eventsMutex);
+        ::events.insert(::events.end(), this->events.begin(), this->events.end());
+    }
+};
+
+static ThreadTrace& threadTrace()
+{
+    static thread_local ThreadTrace trace;
+    if (trace.tid < 0)
+        trace.tid = nextThreadId++;
+    return trace;
+}
+
+static int64_t now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - traceStart).count();
+}
+
+TraceScope::TraceScope(const char* name)
+    : name(name),
+    start(tracing ? now() : -1)
+{
+}
+
+TraceScope::TraceScope(const char* name, const std::string& detail)
+    : name(name),
+    start(tracing ? now() : -1)
+{
+    if (this->start >= 0)
+        this->detail = detail;
+}
+
+TraceScope::~TraceScope()
+{
+    if (this->start < 0 || !tracing)
+        return;
+
+    ThreadTrace& trace = threadTrace();
+    TraceEvent event;
+    event.name = this->name;
+    event.detail.swap(this->detail);
+    event.start = this->start;
+    event.duration = now() - this->start;
+    event.tid = trace.tid;
+    trace.events.push_back(std::move(event));
+}
+
+void setTraceThread(int id, std::string name)
+{
+    if (!tracing)
+        return;
+    threadTrace().tid = id;
+
+    std::lock_guard<std::mutex> lock(eventsMutex);
+    for (auto& thread : threadNames) {
+        if (thread.first == id)
+            return;
+    }
+    threadNames.push_back({ id, name });
+}
+
+TraceSession::TraceSession(std::string path)
+    : path(path)
+{
+    traceStart = std::chrono::steady_clock::now();
+    tracing = true;
+    setTraceThread(0, "main");
+}
+
+TraceSession::~TraceSession()
+{
+    tracing = false;
+
+    std::ofstream file(this->path.c_str());
+    if (!file) {
+        std::cerr << "Could not write trace to " << this->path << std::endl;
+        return;
+    }
+
+    ThreadTrace& own = threadTrace();
+    std::lock_guard<std::mutex> lock(eventsMutex);
+    events.insert(events.end(), own.events.begin(), own.events.end());
+    own.events.clear();
+
+    file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool first = true;
+    for (auto& thread : threadNames) {
+        file << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread.first
+            << ",\"args\":{\"name\":" << nlohmann::json(thread.second).dump() << "}}";
+        first = false;
+    }
+    char times[64];
+    for (auto& event : events) {
+        // Microseconds with nanosecond precision
+        snprintf(times, sizeof(times), "\"ts\":%.3f,\"dur\":%.3f", event.start / 1000.0, event.duration / 1000.0);
+        file << (first ? "" : ",\n") << "{\"name\":" << nlohmann::json(event.name).dump() << ",\"ph\":\"X\",\"pid\":1,\"tid\":"
+            << event.tid << "," << times;
+        if (!event.detail.empty())
+            file << ",\"args\":{\"detail\":" << nlohmann::json(event.detail).dump() << "}";
+        file << "}";
+        first = false;
+    }
+    file << "\n]}" << std::endl;
+
+    std::cout << "Saved trace: " << this->path << " (" << events.size() << " events)" << std::endl;
+    events.clear();
+}